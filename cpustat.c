@@ -0,0 +1,35 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+struct cpustat cs[NCPU];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, total;
+
+  n = getcpustat(cs, NCPU);
+  if(n < 0){
+    printf(2, "cpustat: getcpustat failed\n");
+    exit();
+  }
+  printf(1, "CPU\tBUSY\tIDLE\tUTIL%%\tCSW\tMIGR\tPI\n");
+  for(i = 0; i < n; i++){
+    total = cs[i].busyticks + cs[i].idleticks;
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", cs[i].cpu, cs[i].busyticks,
+           cs[i].idleticks, total ? cs[i].busyticks * 100 / total : 0,
+           cs[i].nswitch, cs[i].nmigrate, cs[i].pievents);
+  }
+
+  printf(1, "\nCPU\tKHIT\tKMISS\tHIT%%\tZHIT\tZMISS\n");
+  for(i = 0; i < n; i++){
+    total = cs[i].kmhits + cs[i].kmmisses;
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\n", cs[i].cpu, cs[i].kmhits,
+           cs[i].kmmisses, total ? cs[i].kmhits * 100 / total : 0,
+           cs[i].zhits, cs[i].zmisses);
+  }
+  exit();
+}
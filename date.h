@@ -6,3 +6,9 @@ struct rtcdate {
   uint month;
   uint year;
 };
+
+// Time since boot, from clock_gettime().
+struct timespec {
+  uint sec;
+  uint nsec;
+};
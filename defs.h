@@ -2,12 +2,16 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct procstat;
+struct cpustat;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct timespec;
 struct superblock;
 
 // bio.c
@@ -40,6 +44,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -68,6 +73,15 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kallocstat(int, struct cpustat*);
+char*           kalloc_zeroed(void);
+void            kref(char*);
+int             krefcnt(char*);
+int             kzerofill(void);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            kmemdump(void);
+int             kfreecount(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -79,6 +93,9 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(int, int);
+void            nanouptime(struct timespec*);
+extern uint     tsckhz;
 void            microdelay(int);
 
 // log.c
@@ -96,6 +113,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -118,13 +136,49 @@ void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
+int             wait2(int*, int*, int*);
+int             getpinfo(struct procstat*, int);
+int             getcpustat(struct cpustat*, int);
+void            schedlatreset(void);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 int             ticks_running(int);
-void            set_lottery_tickets(int, int);
+int             set_lottery_tickets(int, int);
 int             get_lottery_tickets(int);
 int             get_random(int, int);
-struct proc*    get_proc(int);
+struct proc*    getptable_proc(void);
+int             setsched(int);
+int             setrt(int, int, int);
+int             clone(void(*)(void*), void*, void*);
+int             join(uint*);
+int             futexwait(int*, int);
+int             futexwake(int*, int);
+int             lazygrow(int);
+void            execvm(pde_t*, uint);
+void            rtthrottle(void);
+int             setaffinity(int, uint);
+int             getaffinity(int);
+void            ticketlend(int);
+void            ticketreturn(void);
+void            piboost(struct proc*);
+void            piunboost(void);
+int             transfer_tickets(int, int);
+
+// sched.c
+void            schedinit(void);
+void            runqadd(struct proc*);
+struct proc*    runqget(void);
+int             runqempty(void);
+void            runqidle(void);
+void            runqsettickets(struct proc*, int);
+void            runqsetlevel(struct proc*, int);
+int             runqtick(struct proc*);
+int             runqthrottled(struct proc*);
+void            runqwake(struct proc*);
+int             runqsetpolicy(int);
+int             runqpolicy(void);
+void            runqsetaffinity(struct proc*, uint);
 
 //find.c
 //void            find(char *filename);
@@ -141,6 +195,13 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(void);
+void            kmem_cache_init(struct kmem_cache*, char*, uint, void(*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabdump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -188,7 +249,9 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, int);
+int             cowfault(pde_t*, uint);
+int             cowbreak(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
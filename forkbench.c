@@ -0,0 +1,97 @@
+// Process table contention benchmark: 1, 2, 4 and 8 workers
+// each fork and reap children as fast as they can, so every
+// CPU is creating, exiting, waking and looking up processes
+// at once. Each fork and exit also allocates and frees page
+// tables and a kernel stack; khit and kmiss count the kalloc()
+// calls the per-CPU page caches served and missed. Compare
+// runs across CPUS=1, 2 and 4; the header line says which this
+// is. Usage: forkbench [rounds]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "date.h"
+#include "param.h"
+#include "pstat.h"
+
+struct cpustat cs[NCPU];
+
+// Microseconds since boot.
+uint
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(&ts);
+  return ts.sec * 1000000 + ts.nsec / 1000;
+}
+
+// Add up kalloc() page cache hits and misses over all CPUs.
+void
+kmcount(uint *hits, uint *misses)
+{
+  int i, n;
+
+  *hits = *misses = 0;
+  n = getcpustat(cs, NCPU);
+  for(i = 0; i < n; i++){
+    *hits += cs[i].kmhits;
+    *misses += cs[i].kmmisses;
+  }
+}
+
+// Fork and reap rounds children, looking each one up by pid.
+void
+worker(int rounds)
+{
+  int i, pid;
+
+  for(i = 0; i < rounds; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    // Look the child up by pid, then reap it.
+    if(ticks_running(pid) < 0 || wait() != pid){
+      printf(1, "forkbench: lost child %d\n", pid);
+      exit();
+    }
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, rounds;
+  uint start, t, h0, m0, h1, m1;
+
+  rounds = 500;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1){
+    printf(2, "usage: forkbench [rounds]\n");
+    exit();
+  }
+
+  printf(1, "forkbench: %d cpus, %d rounds\n", getcpustat(cs, NCPU), rounds);
+  printf(1, "workers  ms  forks/s  khit  kmiss\n");
+  for(n = 1; n <= 8; n *= 2){
+    kmcount(&h0, &m0);
+    start = now();
+    for(i = 0; i < n; i++){
+      if(fork() == 0)
+        worker(rounds);
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = (now() - start) / 1000;
+    kmcount(&h1, &m1);
+    printf(1, "%d  %d  %d  %d  %d\n", n, t, t > 0 ? n * rounds * 1000 / t : 0,
+           h1 - h0, m1 - m0);
+  }
+  exit();
+}
@@ -17,6 +17,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -145,18 +146,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: an inode is cached only while
+//   something refers to it. ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds the entry, or takes a new one
+//   from the inode slab cache with ref 1 and valid 0 and adds
+//   it to the icache list; otherwise it increments ref.
+//   iput() decrements ref, and the last iput() takes the entry
+//   off the list and gives it back to the slab cache.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid. A new entry starts out invalid; iput() clears
+//   ip->valid only when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -181,9 +184,10 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries. Entries come from a slab cache and are on the icache
+// list while ip->ref > 0; ip->dev and ip->inum indicate which
+// i-node an entry holds, so one must hold icache.lock while
+// using any of those fields, or the list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -191,19 +195,29 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;  // Cached inodes
 } icache;
 
+static struct kmem_cache inodecache;
+
+static void
+inodector(void *v)
+{
+  initsleeplock(&((struct inode*)v)->lock, "inode");
+}
+
+// Set up the inode cache. Runs from main(), since userinit()
+// looks up "/" before the first process reaches iinit().
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&inodecache, "inode", sizeof(struct inode), inodector);
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
@@ -267,31 +281,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate an inode cache entry.
+  if((ip = kmem_cache_alloc(&inodecache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->prev = 0;
+  ip->next = icache.head;
+  if(ip->next)
+    ip->next->prev = ip;
+  icache.head = ip;
   release(&icache.lock);
 
   return ip;
@@ -373,7 +388,16 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // Last reference: the entry goes back to the slab cache.
+    if(ip->prev)
+      ip->prev->next = ip->next;
+    else
+      icache.head = ip->next;
+    if(ip->next)
+      ip->next->prev = ip->prev;
+    kmem_cache_free(&inodecache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -667,11 +691,17 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct files *fs;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // Hold the lock so a sibling thread's chdir can't free cwd.
+    fs = myproc()->files;
+    acquire(&fs->lock);
+    ip = idup(fs->cwd);
+    release(&fs->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -0,0 +1,3 @@
+// futex() operations.
+#define FUTEX_WAIT  0  // Sleep on addr if *addr == val
+#define FUTEX_WAKE  1  // Wake up to val processes sleeping on addr
@@ -119,7 +119,7 @@ ideintr(void)
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
   b->flags &= ~B_DIRTY;
-  wakeup(b);
+  wakeup_one(b);
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -1,6 +1,8 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^n 4096-byte pages
+// with a binary buddy allocator; single pages go through
+// per-CPU caches in front of it.
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +10,65 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "pstat.h"
 
 void freerange(void *vstart, void *vend);
+static char *zpop(void);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;  // Buddy free lists only
 };
 
+// Each CPU keeps up to NKMAG free pages of its own, so most
+// kalloc() and kfree() calls touch no shared lock. An empty
+// cache refills, and a full one drains, half of NKMAG pages
+// at a time from and to the buddy allocator. A CPU's cache
+// is only used by that CPU, with interrupts off.
+struct kmag {
+  struct run *list;
+  int n;
+  uint hits;    // kalloc() calls served from the cache
+  uint misses;  // kalloc() calls that went to the buddy allocator
+  uint zhits;   // kalloc_zeroed() calls served from the zero pool
+  uint zmisses; // kalloc_zeroed() calls that zeroed a page
+};
+
+// The buddy allocator keeps a free list of blocks of 2^k
+// pages for each order k < NBUDDY. A block of order k starts
+// at a physical address aligned to its size, and its buddy
+// is the block whose address differs only in bit k of the
+// page number. Freeing a block whose buddy is also free
+// merges the two into one block of the next order.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[NBUDDY];
+  int nfree[NBUDDY];   // Blocks on each free list
+  struct kmag mag[NCPU];
 } kmem;
 
+// Pages zeroed ahead of time by idle CPUs, for kalloc_zeroed().
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} zpool;
+
+// For each physical page, 1 + the order of the free block
+// starting there, or 0 if no free block starts there.
+static uchar blkorder[PHYSTOP/PGSIZE];
+
+// References to each page kalloc() handed out. Pages shared
+// copy-on-write after fork have one per page table mapping
+// them, and kfree() frees a page only when its last goes.
+// Updated atomically; NPROC < 256.
+static uchar pgref[PHYSTOP/PGSIZE];
+
+#define PGNUM(v)  (V2P(v) / PGSIZE)
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -32,6 +78,7 @@ void
 kinit1(void *vstart, void *vend)
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,7 +98,118 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
 //PAGEBREAK: 21
+// Buddy free list helpers. Caller holds kmem.lock.
+static void
+bpush(char *v, int order)
+{
+  struct run *r = (struct run*)v;
+
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  blkorder[PGNUM(v)] = order + 1;
+}
+
+static void
+bunlink(char *v, int order)
+{
+  struct run *r = (struct run*)v;
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  blkorder[PGNUM(v)] = 0;
+}
+
+// Free the block of 2^order pages at v, merging it with
+// its buddy as long as the buddy is free too.
+static void
+bfree(char *v, int order)
+{
+  uint buddy;
+
+  for(; order < NBUDDY-1; order++){
+    buddy = V2P(v) ^ (PGSIZE << order);
+    if(buddy >= PHYSTOP || blkorder[buddy/PGSIZE] != order + 1)
+      break;
+    bunlink(P2V(buddy), order);
+    if(buddy < V2P(v))
+      v = P2V(buddy);
+  }
+  bpush(v, order);
+}
+
+// Take a block of 2^order pages, splitting a larger
+// block if there is none that size. Returns 0 if none.
+static char*
+balloc(int order)
+{
+  char *v;
+  int k;
+
+  for(k = order; k < NBUDDY && kmem.free[k] == 0; k++)
+    ;
+  if(k == NBUDDY)
+    return 0;
+  v = (char*)kmem.free[k];
+  bunlink(v, k);
+  // Give back the upper half at each order on the way down.
+  while(k > order){
+    k--;
+    bpush(v + (PGSIZE << k), k);
+  }
+  return v;
+}
+
+// Free the 2^order physically contiguous pages at v,
+// which kalloc_order(order) returned.
+void
+kfree_order(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order >= NBUDDY || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  bfree(v, order);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if they cannot be allocated.
+char*
+kalloc_order(int order)
+{
+  char *v;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order >= NBUDDY)
+    return 0;
+  acquire(&kmem.lock);
+  v = balloc(order);
+  release(&kmem.lock);
+  return v;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -60,20 +218,45 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(!kmem.use_lock){
+    // Still booting on one CPU.
+    bfree(v, 0);
+    return;
+  }
+
+  if(pgref[PGNUM(v)] == 0)
+    panic("kfree: not allocated");
+  if(__sync_sub_and_fetch(&pgref[PGNUM(v)], 1) > 0)
+    return;  // still mapped elsewhere
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  r->next = m->list;
+  m->list = r;
+  if(++m->n > NKMAG){
+    // Drain half the cache to the buddy allocator.
+    acquire(&kmem.lock);
+    for(i = 0; i < NKMAG/2; i++){
+      r = m->list;
+      m->list = r->next;
+      bfree((char*)r, 0);
+    }
     release(&kmem.lock);
+    m->n -= NKMAG/2;
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +266,170 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
+  char *v;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    if((v = balloc(0)) != 0)
+      pgref[PGNUM(v)] = 1;
+    return v;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  if(m->n > 0)
+    m->hits++;
+  else {
+    // Refill half the cache from the buddy allocator.
+    m->misses++;
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    while(m->n < NKMAG/2 && (v = balloc(0)) != 0){
+      r = (struct run*)v;
+      r->next = m->list;
+      m->list = r;
+      m->n++;
+    }
     release(&kmem.lock);
+  }
+  if((r = m->list) != 0){
+    m->list = r->next;
+    m->n--;
+  }
+  popcli();
+  if(r == 0)
+    return zpop();  // last resort; already counted
+  pgref[PGNUM(r)] = 1;
+  return (char*)r;
+}
+
+// Add a reference to the page at v, which kalloc() returned.
+void
+kref(char *v)
+{
+  __sync_add_and_fetch(&pgref[PGNUM(v)], 1);
+}
+
+// Return the number of references to the page at v.
+int
+krefcnt(char *v)
+{
+  return pgref[PGNUM(v)];
+}
+
+// Take a page from the zero pool, or return 0 if it is empty.
+// Pool pages came from kalloc(), so they hold one reference.
+static char*
+zpop(void)
+{
+  struct run *r;
+
+  // The pool is empty until kinit2(), and acquire() needs
+  // mycpu(), which does not work before mpinit().
+  if(!kmem.use_lock)
+    return 0;
+  acquire(&zpool.lock);
+  if((r = zpool.list) != 0){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  if(r)
+    r->next = 0;  // the only nonzero word
   return (char*)r;
 }
 
+// Allocate one page of physical memory, filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  char *v;
+  int hit;
+
+  if((v = zpop()) != 0)
+    hit = 1;
+  else {
+    hit = 0;
+    if((v = kalloc()) == 0)
+      return 0;
+    memset(v, 0, PGSIZE);
+  }
+  if(!kmem.use_lock)
+    return v;  // booting; mycpu() may not work yet
+  pushcli();
+  if(hit)
+    kmem.mag[cpuid()].zhits++;
+  else
+    kmem.mag[cpuid()].zmisses++;
+  popcli();
+  return v;
+}
+
+// Zero one page into the pool if it is below NZPOOL pages.
+// Called by idle CPUs; returns 1 if it did any work.
+int
+kzerofill(void)
+{
+  struct run *r;
+  char *v;
+
+  // Other CPUs go idle before kinit2() is done, while the
+  // boot CPU is still filling the free lists without locks.
+  if(!kmem.use_lock)
+    return 0;
+  if(zpool.n >= NZPOOL)  // unlocked peek
+    return 0;
+  if((v = kalloc()) == 0)
+    return 0;
+  memset(v, 0, PGSIZE);
+  r = (struct run*)v;
+  acquire(&zpool.lock);
+  r->next = zpool.list;
+  zpool.list = r;
+  zpool.n++;
+  release(&zpool.lock);
+  return 1;
+}
+
+// Fill in cpu's page allocator counters.
+void
+kallocstat(int cpu, struct cpustat *cs)
+{
+  cs->kmhits = kmem.mag[cpu].hits;
+  cs->kmmisses = kmem.mag[cpu].misses;
+  cs->zhits = kmem.mag[cpu].zhits;
+  cs->zmisses = kmem.mag[cpu].zmisses;
+}
+
+// Return the number of free pages, counting those in the
+// per-CPU caches and the zero pool.
+int
+kfreecount(void)
+{
+  int i, k, n;
+
+  n = 0;
+  acquire(&kmem.lock);
+  for(k = 0; k < NBUDDY; k++)
+    n += kmem.nfree[k] << k;
+  for(i = 0; i < NCPU; i++)
+    n += kmem.mag[i].n;  // unlocked peek
+  release(&kmem.lock);
+  return n + zpool.n;
+}
+
+// Print the number of free blocks of each order.
+// For debugging; runs with procdump() on ^P.
+void
+kmemdump(void)
+{
+  int k, pages;
+
+  pages = 0;
+  cprintf("free blocks by order:");
+  for(k = 0; k < NBUDDY; k++){
+    cprintf(" %d", kmem.nfree[k]);
+    pages += kmem.nfree[k] << k;
+  }
+  cprintf(" (%d pages), %d zeroed\n", pages, zpool.n);
+}
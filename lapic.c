@@ -41,7 +41,20 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+// 8253/8254 programmable interval timer, channel 2.
+#define PIT_HZ     1193182    // Input clock frequency
+#define PIT_CH2    0x42       // Channel 2 data port
+#define PIT_MODE   0x43       // Mode/command register
+#define PIT_GATE   0x61       // Channel 2 gate (bit 0) and output (bit 5)
+#define CALMS      10         // Calibration interval, milliseconds
+
 volatile uint *lapic;  // Initialized in mp.c
+uint tsckhz;           // TSC cycles per millisecond; 0 if not calibrated
+static uint lapickhz;  // Timer counts per millisecond
+static uint64 boottsc; // TSC at calibration
+static int calibrated;
+
+static uint div64(uint64 *n, uint d);
 
 //PAGEBREAK!
 static void
@@ -51,9 +64,48 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure the timer and TSC rates against CALMS milliseconds
+// of PIT channel 2, which counts a fixed-frequency clock.
+// Runs once, on the boot CPU, before interrupts are enabled.
+static void
+calibrate(void)
+{
+  uint count, n, t;
+  uint64 tsc;
+
+  count = PIT_HZ * CALMS / 1000;
+  outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(PIT_MODE, 0xB0);  // channel 2, lobyte/hibyte, one-shot
+  outb(PIT_CH2, count & 0xFF);
+  outb(PIT_CH2, count >> 8);
+
+  // One-shot, masked, from the largest count.
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, 0xFFFFFFFF);
+  tsc = rdtsc();
+
+  // The PIT output goes high when the count reaches zero.
+  // Each port read takes about a microsecond on the ISA bus,
+  // so give up after ten intervals' worth of reads, or once
+  // the LAPIC timer runs out: there is no PIT, and the timer
+  // keeps its old fixed count.
+  for(n = 0; (inb(PIT_GATE) & 0x20) == 0; n++)
+    if(n > CALMS*10000 || lapic[TCCR] == 0)
+      return;
+
+  t = 0xFFFFFFFF - lapic[TCCR];
+  tsc = rdtsc() - tsc;
+  lapickhz = t / CALMS;
+  tsckhz = (uint)tsc / CALMS;
+  boottsc = rdtsc();
+}
+
 void
 lapicinit(void)
 {
+  uint64 n;
+
   if(!lapic)
     return;
 
@@ -61,12 +113,19 @@ lapicinit(void)
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
   // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // from lapic[TICR] and then issues an interrupt, HZ
+  // times a second once calibrated against the PIT.
+  // The boot CPU gets here first; the CPUs share a bus
+  // clock, so its measurement holds for all of them.
+  if(!calibrated){
+    calibrated = 1;
+    calibrate();
+  }
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  n = (uint64)lapickhz * 1000;  // may not fit in 32 bits
+  div64(&n, HZ);
+  lapicw(TICR, lapickhz ? (uint)n : 10000000);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,11 +172,59 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Divide *n by d in place and return the remainder,
+// without the 64-bit division helpers from libgcc.
+static uint
+div64(uint64 *n, uint d)
+{
+  uint hi, lo, q, r;
+
+  hi = *n >> 32;
+  lo = *n;
+  q = hi / d;
+  hi %= d;
+  asm("divl %4" : "=a" (lo), "=d" (r) : "a" (lo), "d" (hi), "rm" (d));
+  *n = (uint64)q << 32 | lo;
+  return r;
+}
+
 // Spin for a given number of microseconds.
-// On real hardware would want to tune this dynamically.
+// Uses the TSC once it is calibrated; before that,
+// boot-time callers get no delay, as under QEMU.
 void
 microdelay(int us)
 {
+  uint64 n, end;
+
+  if(tsckhz == 0)
+    return;
+  n = (uint64)tsckhz * us;
+  div64(&n, 1000);
+  end = rdtsc() + n;
+  while(rdtsc() < end)
+    ;
+}
+
+// Time since boot from the TSC, in seconds and nanoseconds.
+// Falls back to clock ticks if the TSC was not calibrated.
+void
+nanouptime(struct timespec *ts)
+{
+  uint64 n, frac;
+  uint cycles, ms;
+
+  if(tsckhz == 0){
+    ts->sec = ticks / HZ;
+    ts->nsec = ticks % HZ * (1000000000 / HZ);
+    return;
+  }
+  n = rdtsc() - boottsc;
+  cycles = div64(&n, tsckhz);  // n is now milliseconds
+  ms = div64(&n, 1000);        // and now seconds
+  frac = (uint64)cycles * 1000000;
+  div64(&frac, tsckhz);
+  ts->sec = n;
+  ts->nsec = ms * 1000000 + (uint)frac;
 }
 
 #define CMOS_PORT    0x70
@@ -160,6 +267,18 @@ lapicstartap(uchar apicid, uint addr)
   }
 }
 
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  while(lapic[ICRLO] & DELIVS)
+    ;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+}
+
 #define CMOS_STATA   0x0a
 #define CMOS_STATB   0x0b
 #define CMOS_UIP    (1 << 7)        // RTC update in progress
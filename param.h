@@ -2,8 +2,6 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -13,4 +11,18 @@
 #define FSSIZE       250000  // size of file system in blocks
 #define INTIAL_TICKETS 10
 #define MAX_TICKETS 100
+#define NMLFQ         4  // number of MLFQ priority levels
+#define MLFQQUANTUM   1  // MLFQ level-0 quantum in ticks, doubling per level
+#define MLFQBOOST   100  // ticks between MLFQ priority boosts
+#define CFSMINGRAN    2  // CFS minimum ticks before preemption
+#define MIGRATECOST   1  // ticks a process stays cache-hot on its last CPU
+#define NKMAG        32  // free pages cached per CPU by kalloc
+#define NBUDDY       11  // buddy allocator block orders, 4 KB to 4 MB
+#define NSLABMAG      8  // free objects cached per CPU by each slab cache
+#define NZPOOL       64  // pages kept zeroed by idle CPUs
+#define RTMAXUTIL   950  // per mille of a CPU admitted to real-time processes
+#define NLATBUCKET   32  // log2 buckets in scheduling latency histograms
+#ifndef HZ
+#define HZ          100  // clock ticks per second; make HZ=n to change
+#endif
 #define PATH_MAX 4096
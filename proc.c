@@ -5,11 +5,35 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "pstat.h"
+#include "sched.h"
+#include "slab.h"
 
 
-struct {
+#define NSLEEPQ 64  // Wait queue hash buckets
+#define NPIDHASH 64 // Pid hash buckets
+
+// Sleeping processes wait on a queue hashed by channel, oldest
+// first, so wakeup looks only at processes that might match.
+struct sleepq {
   struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+};
+
+// Locking. Each process's lock protects its state, chan and
+// killed; the scheduler holds it across the switch to and from
+// the process. ptable.lock protects only the free list and the
+// pid hash, and wait_lock the parent/child links. A wait queue's
+// lock protects its links. Lock order: wait_lock, then any lock
+// passed to sleep, then a wait queue's lock, then p->lock, then
+// a run queue's lock (sched.c). ptable.lock comes before p->lock.
+struct {
+  struct spinlock lock;            // Free list and pid hash
   struct proc proc[NPROC];
+  struct sleepq sleepq[NSLEEPQ];
+  struct proc *freelist;           // UNUSED slots
+  struct proc *pidhash[NPIDHASH];  // Other slots, by pid
 } ptable;
 
 static struct proc *initproc;
@@ -19,13 +43,66 @@ extern void forkret(void);
 extern void trapret(void);
 extern uint ticks;
 
-static void wakeup1(void *chan);
+static int elapsed(struct proc *p, enum procstate state);
+static void setstate(struct proc *p, enum procstate state);
+static void setrunnable(struct proc *p);
+static void recordlatency(struct cpu *c, struct proc *p);
+static void retick(struct proc *p);
+static void lend1(struct proc *from, struct proc *to);
+static void return1(struct proc *p);
+static void reap(struct proc *p);
+static int wakeupn(void *chan, int n);
+static struct sleepq *sleepqueue(void *chan);
+static int rtdensity(struct proc *p);
+static struct vm *vmalloc(void);
+static void vmjoin(struct proc *p, struct vm *vm);
+static int vmleave(struct proc *p);
+static void filesctor(void *v);
+static struct files *filesalloc(void);
+static struct files *filescopy(struct files *fs);
+static void filesput(struct files *fs);
+
+static struct spinlock wait_lock;  // Parent/child links
+static struct spinlock rtlock;
+static int rtbw;  // Admitted real-time density, per mille; rtlock
+
+// Address spaces. Threads made by clone() share their creator's
+// page table; ref counts the processes using it, and the last
+// one to be reaped frees it. A process holds one address space,
+// so NPROC of them are enough. vmlock protects the table,
+// each vm's procs list, p->vm, and p->sz for processes sharing
+// an address space.
+static struct vm vms[NPROC];
+static struct spinlock vmlock;
+
+// File tables, shared the same way; see struct files.
+static struct kmem_cache filescache;
+
+static struct spinlock futexlock;
 
 
 void
 pinit(void)
 {
+  struct proc *p;
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&wait_lock, "wait");
+  initlock(&vmlock, "vm");
+  initlock(&rtlock, "rt");
+  initlock(&futexlock, "futex");
+  for(i = 0; i < NPROC; i++)
+    initlock(&vms[i].lock, "vm");
+  kmem_cache_init(&filescache, "files", sizeof(struct files), filesctor);
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&ptable.sleepq[i].lock, "sleepq");
+  for(p = &ptable.proc[NPROC-1]; p >= ptable.proc; p--){
+    initlock(&p->lock, "proc");
+    p->hnext = ptable.freelist;
+    ptable.freelist = p;
+  }
+  schedinit();
 }
 
 // Must be called with interrupts disabled
@@ -67,12 +144,111 @@ myproc(void) {
   return p;
 }
 
+// Process table indexes. UNUSED slots are on a free list and
+// every other slot is in a hash table by pid, under ptable.lock.
+// Each process is also on its parent's children list or, once
+// it has exited, its parent's zombies list, under wait_lock.
+
+// The pid hash chain holding pid.
+static struct proc**
+pidchain(int pid)
+{
+  return &ptable.pidhash[(uint)pid % NPIDHASH];
+}
+
+// Return the process with the given pid with its lock held,
+// or 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = *pidchain(pid); p; p = p->hnext)
+    if(p->pid == pid){
+      acquire(&p->lock);
+      break;
+    }
+  release(&ptable.lock);
+  return p;
+}
+
+// Unhash p and put its slot back on the free list.
+static void
+freeslot(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&ptable.lock);
+  for(pp = pidchain(p->pid); *pp; pp = &(*pp)->hnext)
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  acquire(&p->lock);
+  p->pid = 0;
+  p->state = UNUSED;
+  release(&p->lock);
+  p->hnext = ptable.freelist;
+  ptable.freelist = p;
+  release(&ptable.lock);
+}
+
+static void
+siblink(struct proc **head, struct proc *p)
+{
+  p->sibprev = 0;
+  p->sibnext = *head;
+  if(*head)
+    (*head)->sibprev = p;
+  *head = p;
+}
+
+static void
+sibunlink(struct proc **head, struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    *head = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->sibnext = p->sibprev = 0;
+}
+
+// Make p a child of parent, on its children or zombies list.
+// Caller holds wait_lock. Processes become ZOMBIE only under
+// wait_lock, so p->state can be read here without p->lock.
+static void
+adopt(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  siblink(p->state == ZOMBIE ? &parent->zombies : &parent->children, p);
+  if(p->thread)
+    parent->nthread++;
+  else
+    parent->nchild++;
+}
+
+// Undo adopt().
+static void
+disown(struct proc *p)
+{
+  struct proc *parent = p->parent;
+
+  sibunlink(p->state == ZOMBIE ? &parent->zombies : &parent->children, p);
+  if(p->thread)
+    parent->nthread--;
+  else
+    parent->nchild--;
+  p->parent = 0;
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
-static int next_fifo_position = 0;  // Global counter for FIFO position
 static struct proc*
 allocproc(void)
 {
@@ -81,29 +257,59 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
+  if((p = ptable.freelist) != 0)
+    goto found;
 
   release(&ptable.lock);
   return 0;
 
 found:
+  ptable.freelist = p->hnext;
+  acquire(&p->lock);
   p->state = EMBRYO;
   p->pid = nextpid++;
-  p->ctime = ticks; //record the creation time for FIFO
+  p->killed = 0;
+  release(&p->lock);
+  p->hnext = *pidchain(p->pid);
+  *pidchain(p->pid) = p;
+  release(&ptable.lock);
+
+  p->parent = 0;
+  p->children = 0;
+  p->zombies = 0;
+  p->nchild = 0;
+  p->nthread = 0;
+  p->thread = 0;
+  p->ctime = ticks; //record the creation time
   p->retime = 0;
   p->rutime = 0;
   p->stime = 0;
-  p->fifo_position = next_fifo_position++;  // Set FIFO position
+  p->stamp = ticks;
+  p->firstrun = -1;
+  memset(p->lathist, 0, sizeof(p->lathist));
   p->lottery_tickets = INTIAL_TICKETS;
-
-
-  release(&ptable.lock);
+  p->basetickets = INTIAL_TICKETS;
+  p->lentto = 0;
+  p->lent = 0;
+  p->lentin = 0;
+  p->piboost = 0;
+  p->nsleeplocks = 0;
+  p->rqcpu = -1;
+  p->lastcpu = -1;
+  p->cpumask = ~0;
+  p->heapidx = -1;
+  p->pass = 0;
+  p->level = 0;
+  p->slice = 0;
+  p->epoch = ticks / MLFQBOOST;
+  p->vruntime = 0;
+  p->rtruntime = 0;
+  p->rtthrottled = 0;
+  p->rtmisses = 0;
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    freeslot(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -141,6 +347,9 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  acquire(&vmlock);
+  vmjoin(p, vms);
+  release(&vmlock);
   p->sz = PGSIZE;
   p->ctime = ticks;
   memset(p->tf, 0, sizeof(*p->tf));
@@ -153,17 +362,136 @@ userinit(void)
   p->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = filesalloc()) == 0)
+    panic("userinit: out of memory?");
+  p->files->cwd = namei("/");
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  acquire(&p->lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
-  release(&ptable.lock);
+  release(&p->lock);
+}
+
+// Find an unused address space, for vmjoin.
+// Caller holds vmlock.
+static struct vm*
+vmalloc(void)
+{
+  struct vm *vm;
+
+  for(vm = vms; vm < &vms[NPROC]; vm++)
+    if(vm->ref == 0)
+      return vm;
+  panic("vmalloc");
+}
+
+// Make p one of the processes using address space vm.
+// Caller holds vmlock.
+static void
+vmjoin(struct proc *p, struct vm *vm)
+{
+  p->vm = vm;
+  p->vmnext = vm->procs;
+  vm->procs = p;
+  vm->ref++;
+}
+
+// Take p off its address space and return the number of
+// processes still using it. Caller holds vmlock.
+static int
+vmleave(struct proc *p)
+{
+  struct proc **pp;
+  struct vm *vm = p->vm;
+
+  for(pp = &vm->procs; *pp; pp = &(*pp)->vmnext)
+    if(*pp == p){
+      *pp = p->vmnext;
+      break;
+    }
+  p->vm = 0;
+  p->vmnext = 0;
+  return --vm->ref;
+}
+
+static void
+filesctor(void *v)
+{
+  initlock(&((struct files*)v)->lock, "files");
+}
+
+// Allocate an empty file table with one reference.
+static struct files*
+filesalloc(void)
+{
+  struct files *fs;
+
+  if((fs = kmem_cache_alloc(&filescache)) == 0)
+    return 0;
+  fs->ref = 1;
+  memset(fs->ofile, 0, sizeof(fs->ofile));
+  fs->cwd = 0;
+  return fs;
+}
+
+// Make a copy of file table fs for a child, as fork does.
+static struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc()) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  return nfs;
+}
+
+// Drop a reference to file table fs. The last one closes
+// its files and releases its directory.
+static void
+filesput(struct files *fs)
+{
+  int fd, ref;
+
+  acquire(&fs->lock);
+  ref = --fs->ref;
+  release(&fs->lock);
+  if(ref > 0)
+    return;
+
+  for(fd = 0; fd < NOFILE; fd++){
+    if(fs->ofile[fd]){
+      fileclose(fs->ofile[fd]);
+      fs->ofile[fd] = 0;
+    }
+  }
+  begin_op();
+  iput(fs->cwd);
+  end_op();
+  fs->cwd = 0;
+  kmem_cache_free(&filescache, fs);
+}
+
+// Set the size of p's address space, as seen by p and by
+// every thread sharing it. Caller holds vmlock.
+static void
+setsz(struct proc *p, uint sz)
+{
+  struct proc *q;
+
+  for(q = p->vm->procs; q; q = q->vmnext)
+    q->sz = sz;
 }
 
 // Grow current process's memory by n bytes.
@@ -179,21 +507,71 @@ growproc(int n)
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
+    // Threads on other CPUs could keep using the freed pages
+    // through stale TLB entries, and nothing would flush them.
+    acquire(&vmlock);
+    if(curproc->vm->ref > 1){
+      release(&vmlock);
+      return -1;
+    }
+    release(&vmlock);
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
-  curproc->sz = sz;
+  acquire(&vmlock);
+  setsz(curproc, sz);
+  release(&vmlock);
   switchuvm(curproc);
   return 0;
 }
 
+// Grow current process's memory by n bytes without allocating
+// it; trap() maps pages as they are first touched.
+// Return the old size.
+int
+lazygrow(int n)
+{
+  struct proc *curproc = myproc();
+  uint sz;
+
+  acquire(&vmlock);
+  sz = curproc->sz;
+  setsz(curproc, sz + n);
+  release(&vmlock);
+  return sz;
+}
+
+// Give the current process the new page table pgdir of size
+// sz, as exec does. Threads sharing the old address space
+// keep it.
+void
+execvm(pde_t *pgdir, uint sz)
+{
+  struct proc *curproc = myproc();
+  pde_t *oldpgdir;
+
+  acquire(&vmlock);
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = pgdir;
+  curproc->sz = sz;
+  if(curproc->vm->ref > 1){
+    vmleave(curproc);
+    vmjoin(curproc, vmalloc());
+    oldpgdir = 0;
+  }
+  release(&vmlock);
+  switchuvm(curproc);
+  if(oldpgdir)
+    freevm(oldpgdir);
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
 int
 fork(void)
 {
-  int i, pid;
+  int pid, cow;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -202,34 +580,112 @@ fork(void)
     return -1;
   }
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  // Copy process state from proc. Share pages copy-on-write,
+  // unless threads on other CPUs might hold writable TLB
+  // entries for them.
+  acquire(&vmlock);
+  cow = curproc->vm->ref == 1;
+  release(&vmlock);
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, cow)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    freeslot(np);
+    return -1;
+  }
+  if((np->files = filescopy(curproc->files)) == 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    freeslot(np);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
+  np->vruntime = curproc->vruntime;
+  np->cpumask = curproc->cpumask;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  acquire(&vmlock);
+  vmjoin(np, vmalloc());
+  release(&vmlock);
+
+  acquire(&wait_lock);
+  adopt(curproc, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread: a process sharing the current process's
+// address space, open files and current directory, that runs
+// fn(arg) on the one-page user stack at stack. Returns the
+// thread's pid; join() reaps it.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int pid, shared;
+  uint sp, ustack[2];
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  // Push arg and a fake return PC. This may fault the
+  // stack page in, so do it before taking any locks.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  memmove((void*)sp, ustack, sizeof(ustack));
+
+  // The first thread to share the address space ends
+  // copy-on-write in it; see cowbreak.
+  acquire(&vmlock);
+  shared = curproc->vm->ref > 1;
+  release(&vmlock);
+  if(!shared && cowbreak(curproc->pgdir, curproc->sz) < 0)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  np->pgdir = curproc->pgdir;
+  np->ustack = (uint)stack;
+  np->cpumask = curproc->cpumask;
+  np->vruntime = curproc->vruntime;
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+
+  acquire(&curproc->files->lock);
+  curproc->files->ref++;
+  release(&curproc->files->lock);
+  np->files = curproc->files;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
 
-  acquire(&ptable.lock);
+  acquire(&vmlock);
+  vmjoin(np, curproc->vm);
+  np->sz = curproc->sz;
+  release(&vmlock);
 
-  np->state = RUNNABLE;
+  acquire(&wait_lock);
+  np->thread = 1;
+  adopt(curproc, np);
+  release(&wait_lock);
 
-  release(&ptable.lock);
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
 
   return pid;
 }
@@ -242,148 +698,202 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, unless threads still share them.
+  filesput(curproc->files);
+  curproc->files = 0;
 
-  begin_op();
-  iput(curproc->cwd);
-  end_op();
-  curproc->cwd = 0;
+  // Give back any real-time reservation.
+  acquire(&rtlock);
+  rtbw -= rtdensity(curproc);
+  curproc->rtruntime = 0;
+  release(&rtlock);
 
-  acquire(&ptable.lock);
+  acquire(&wait_lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
-
-  // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
-  }
-
-  // Decrement fifo_position of all processes with a higher position.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if(p->state != UNUSED && p->fifo_position > curproc->fifo_position) {
-      p->fifo_position--;
-    }
+  wakeup(curproc->parent);
+
+  // Pass abandoned children to init. Threads lose their tie
+  // to our address space, so init's wait() reaps them.
+  while((p = curproc->children) != 0 || (p = curproc->zombies) != 0){
+    disown(p);
+    p->thread = 0;
+    adopt(initproc, p);
+    if(p->state == ZOMBIE)
+      wakeup(initproc);
   }
 
-  // Jump into the scheduler, never to return.
-  curproc->state = ZOMBIE;
+  // Jump into the scheduler, never to return. The parent
+  // can't reap us until the scheduler releases our lock.
+  acquire(&curproc->lock);
+  p = curproc->parent;
+  disown(curproc);
+  setstate(curproc, ZOMBIE);
+  adopt(p, curproc);
+  release(&wait_lock);
   sched();
   panic("zombie exit");
 }
 
+// Free a ZOMBIE process's kernel stack and its reference to
+// its address space, and put its slot back on the free list.
+// Caller holds wait_lock and p->lock; reap releases p->lock.
+static void
+reap(struct proc *p)
+{
+  pde_t *pgdir;
+
+  kfree(p->kstack);
+  p->kstack = 0;
+  acquire(&vmlock);
+  pgdir = vmleave(p) == 0 ? p->pgdir : 0;
+  p->pgdir = 0;
+  release(&vmlock);
+  if(pgdir)
+    freevm(pgdir);
+  disown(p);
+  p->name[0] = 0;
+  p->killed = 0;
+  p->ctime = 0;
+  release(&p->lock);
+  freeslot(p);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
 wait(void)
+{
+  return wait2(0, 0, 0);
+}
+
+// Like wait(), but also report how many ticks the child spent
+// RUNNABLE, RUNNING and SLEEPING, through any non-null pointer.
+int
+wait2(int *retime, int *rutime, int *stime)
 {
   struct proc *p;
-  int havekids, pid;
+  int pid;
   struct proc *curproc = myproc();
   
-  acquire(&ptable.lock);
+  acquire(&wait_lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
+    // Look for an exited child; threads are for join().
+    for(p = curproc->zombies; p; p = p->sibnext){
+      if(!p->thread){
+        // Found one. Its lock is held until it is off its CPU.
+        acquire(&p->lock);
+        if(retime)
+          *retime = p->retime;
+        if(rutime)
+          *rutime = p->rutime;
+        if(stime)
+          *stime = p->stime;
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->ctime = 0;
-        p->state = UNUSED;
-        release(&ptable.lock);
+        reap(p);
+        release(&wait_lock);
         return pid;
       }
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
-      release(&ptable.lock);
+    if(curproc->nchild == 0 || curproc->killed){
+      release(&wait_lock);
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
-  }
-}
-
-
-// int wait2(int *retime, int *rutime, int *stime) {
-//   struct proc *p;
-//   int havekids, pid;
-//   acquire(&ptable.lock);
-//   for(;;){
-//     // Scan through table looking for zombie children.
-//     havekids = 0;
-//     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-//       if(p->parent != myproc())
-//         continue;
-//       havekids = 1;
-//       if(p->state == ZOMBIE){
-//         // Found one.
-//         *retime = p->retime;
-//         *rutime = p->rutime;
-//         *stime = p->stime;
-//         pid = p->pid;
-//         kfree(p->kstack);
-//         p->kstack = 0;
-//         freevm(p->pgdir);
-//         p->state = UNUSED;
-//         p->pid = 0;
-//         p->parent = 0;
-//         p->name[0] = 0;
-//         p->killed = 0;
-//         p->ctime = 0;
-//         p->retime = 0;
-//         p->rutime = 0;
-//         p->stime = 0;
-       
-//         release(&ptable.lock);
-//         return pid;
-//       }
-//     }
-
-//     // No point waiting if we don't have any children.
-//     if(!havekids || myproc()->killed){
-//       release(&ptable.lock);
-//       return -1;
-//     }
-
-//     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-//     sleep(myproc(), &ptable.lock);  //DOC: wait-sleep
-//   }
-// }
+    // Wait for children to exit.  (See wakeup call in proc_exit.)
+    // Under LOTTERY, lend a child our tickets meanwhile.
+    if(runqpolicy() == SCHED_LOTTERY){
+      for(p = curproc->children; p && p->thread; p = p->sibnext)
+        ;
+      if(p){
+        acquire(&p->lock);
+        lend1(curproc, p);
+        release(&p->lock);
+      }
+    }
+    sleep(curproc, &wait_lock);  //DOC: wait-sleep
+    return1(curproc);
+  }
+}
+
+// Wait for a thread made by clone() to exit and return its
+// pid, storing its user stack in *stack.
+// Return -1 if this process has no threads.
+int
+join(uint *stack)
+{
+  struct proc *p;
+  int pid;
+  struct proc *curproc = myproc();
+
+  acquire(&wait_lock);
+  for(;;){
+    for(p = curproc->zombies; p; p = p->sibnext){
+      if(p->thread){
+        acquire(&p->lock);
+        pid = p->pid;
+        *stack = p->ustack;
+        reap(p);
+        release(&wait_lock);
+        return pid;
+      }
+    }
+    if(curproc->nthread == 0 || curproc->killed){
+      release(&wait_lock);
+      return -1;
+    }
+    sleep(curproc, &wait_lock);  // see wakeup in exit
+  }
+}
+
+// Copy a snapshot of up to max in-use processes into ps.
+// Returns the number of entries filled in.
+int
+getpinfo(struct procstat *ps, int max)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  acquire(&wait_lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && n < max; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED){
+      release(&p->lock);
+      continue;
+    }
+    ps[n].pid = p->pid;
+    ps[n].ppid = p->parent ? p->parent->pid : 0;
+    ps[n].state = p->state;
+    safestrcpy(ps[n].name, p->name, sizeof(ps[n].name));
+    ps[n].tickets = p->lottery_tickets;
+    ps[n].ticks = p->ticks;
+    ps[n].ctime = p->ctime;
+    ps[n].retime = p->retime + elapsed(p, RUNNABLE);
+    ps[n].rutime = p->rutime + elapsed(p, RUNNING);
+    ps[n].stime = p->stime + elapsed(p, SLEEPING);
+    ps[n].rsptime = p->firstrun < 0 ? -1 : p->firstrun - p->ctime;
+    ps[n].rtperiod = p->rtruntime ? p->rtperiod : 0;
+    ps[n].rtmisses = p->rtmisses;
+    memmove(ps[n].lat, p->lathist, sizeof(ps[n].lat));
+    release(&p->lock);
+    n++;
+  }
+  release(&wait_lock);
+  return n;
+}
 
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run from the run queues (sched.c)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -393,123 +903,50 @@ scheduler(void)
   struct proc *p;
   struct cpu *c = mycpu();
   c->proc = 0;
+  c->rand = (uint)rdtsc() ^ ((c - cpus + 1) * 2654435761U);
+  if(c->rand == 0)
+    c->rand = 1;
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    
-    // #ifdef FIFO
-    // struct proc *minP = 0;
-    // for(p = ptable.proc; p < &ptable.proc[NPROC] ; p++){
-    //   if(p->state != RUNNABLE)
-    //      continue;
-
-    //   // ignore init and sh processes from FCFS
-    //   if(p->pid > 1){
-    //     if (minP != 0){
-    //       // here I find the process with the lowest creation time (the first one that was created)
-    //       if(p->ctime < minP->ctime)
-    //          minP = p;
-    //     } else {
-    //             minP = p;
-    //     }
-    //   }
-    // }
-
-    // // If I found the process which I created first and it is runnable I run it
-    // //(in the real FCFS I should not check if it is runnable, but for testing purposes I have to make this control, otherwise every time I launch
-    // // a process which does I/0 operation (every simple command) everything will be blocked
-    // if(minP != 0 && minP->state == RUNNABLE)
-    //    p = minP;
-    struct proc *next_proc = 0;
-
-    #ifdef FIFO
-    //cprintf("fifo");
-    int lowest_position = -1;
-        for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-          if(p->state != RUNNABLE)
-            continue;
-          if (lowest_position == -1 || p->fifo_position < lowest_position) {
-            next_proc = p;
-            lowest_position = p->fifo_position;
-          }
-        }
-
-        if(next_proc != 0) {
-          p = next_proc;
-
-          // Switch to chosen process
-          c->proc = p;
-          switchuvm(p);
-          p->state = RUNNING;
-          p->ticks++;
-          swtch(&(c->scheduler), p->context);
-          switchkvm();
-
-          // Process is done running for now
-          c->proc = 0;
-        }
-    #else
-    #ifdef LOTTERY
-    //cprintf("lottery");
-    int total_tickets = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-      if(p->state != RUNNABLE) continue;
-      total_tickets += p->lottery_tickets;
-    }
-    if(total_tickets == 0) {
-      release(&ptable.lock);
-      continue;
-    }
-    int lottery_num = get_random(0, total_tickets);
-
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-      if(p->state != RUNNABLE) continue;
-      lottery_num -= p->lottery_tickets;
-      if(lottery_num <= 0) {
-        next_proc = p;
-        break;
-      }
-    }
-    if(next_proc != 0) {
-      p = next_proc;
+    // Don't touch any run queue lock unless some queue has work.
+    p = 0;
+    if(!runqempty() && (p = runqget()) != 0){
+      // Switch to chosen process.  It is the process's job
+      // to release p->lock and then reacquire it
+      // before jumping back to us. If p is still switching
+      // out on another CPU, that CPU holds p->lock until it
+      // is done.
+      acquire(&p->lock);
       c->proc = p;
+      c->nswitch++;
+      if(p->lastcpu >= 0 && p->lastcpu != c - cpus)
+        c->nmigrate++;
+      p->lastcpu = c - cpus;
       switchuvm(p);
-      p->state = RUNNING;
-      p->ticks++;
+      recordlatency(c, p);
+      setstate(p, RUNNING);
+      if(p->firstrun < 0)
+        p->firstrun = ticks;
+      p->runticks = 0;
       swtch(&(c->scheduler), p->context);
       switchkvm();
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
       c->proc = 0;
+      p->lastrun = ticks;
+      release(&p->lock);
     }
-    #else
-    //cprintf("rr");
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-           continue;
-        // Switch to chosen process. It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-        p->ticks++;
-        swtch(&(c->scheduler), p->context);
-        switchkvm();
-    
-        // Process is done running for now.
-        // It should have changed its p-state before coming back.
-        c->proc = 0;
-    }
-    #endif
-    #endif
-    release(&ptable.lock);
-    }
-  }
 
+    // Nothing we can run: halt until an interrupt or a wakeup IPI.
+    if(p == 0)
+      runqidle();
+  }
+}
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -522,8 +959,8 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&p->lock))
+    panic("sched p->lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
@@ -539,10 +976,12 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  struct proc *p = myproc();
+
+  acquire(&p->lock);  //DOC: yieldlock
+  setrunnable(p);
   sched();
-  release(&ptable.lock);
+  release(&p->lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -551,8 +990,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -566,12 +1005,20 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// The wait queue for chan.
+static struct sleepq*
+sleepqueue(void *chan)
+{
+  return &ptable.sleepq[((uint)chan * 2654435761U >> 16) % NSLEEPQ];
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q;
   
   if(p == 0)
     panic("sleep");
@@ -579,19 +1026,28 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
+  // Must acquire chan's wait queue lock in order to
+  // join the queue. Once we hold it, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  // (wakeup runs with the queue locked),
+  // so it's okay to release lk. p->lock is needed
+  // to change p->state and then call sched.
+  q = sleepqueue(chan);
+  acquire(&q->lock);  //DOC: sleeplock1
+  release(lk);
+  acquire(&p->lock);
+
   // Go to sleep.
   p->chan = chan;
-  p->state = SLEEPING;
+  p->slnext = 0;
+  p->slprev = q->tail;
+  if(q->tail)
+    q->tail->slnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  setstate(p, SLEEPING);
+  release(&q->lock);
 
   sched();
 
@@ -599,32 +1055,168 @@ sleep(void *chan, struct spinlock *lk)
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  release(&p->lock);  //DOC: sleeplock2
+  acquire(lk);
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Wake up to n of the processes sleeping on chan, oldest
+// first, and return how many were woken. Throttled real-time
+// processes stay asleep until their next period.
+static int
+wakeupn(void *chan, int n)
+{
+  struct sleepq *q;
+  struct proc *p, *next;
+  int woken;
+
+  woken = 0;
+  q = sleepqueue(chan);
+  acquire(&q->lock);
+  for(p = q->head; p && woken < n; p = next){
+    next = p->slnext;
+    if(p->chan == chan){
+      acquire(&p->lock);
+      if(!runqthrottled(p)){
+        setrunnable(p);
+        woken++;
+      }
+      release(&p->lock);
+    }
+  }
+  release(&q->lock);
+  return woken;
+}
+
+// Wake p if it is asleep, whatever it is sleeping on.
 static void
-wakeup1(void *chan)
+wakeproc(struct proc *p)
+{
+  struct sleepq *q;
+  void *chan;
+
+  for(;;){
+    acquire(&p->lock);
+    if(p->state != SLEEPING){
+      release(&p->lock);
+      return;
+    }
+    chan = p->chan;
+    release(&p->lock);
+
+    // Retake the locks in order; p may have moved meanwhile.
+    q = sleepqueue(chan);
+    acquire(&q->lock);
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan){
+      setrunnable(p);
+      release(&p->lock);
+      release(&q->lock);
+      return;
+    }
+    release(&p->lock);
+    release(&q->lock);
+  }
+}
+
+// Ticks p has spent in state since its last state change.
+static int
+elapsed(struct proc *p, enum procstate state)
+{
+  return p->state == state ? ticks - p->stamp : 0;
+}
+
+// Move p to state, first charging the ticks since its last
+// state change to the state it is leaving.
+// p->lock must be held.
+static void
+setstate(struct proc *p, enum procstate state)
+{
+  p->stime += elapsed(p, SLEEPING);
+  p->retime += elapsed(p, RUNNABLE);
+  p->rutime += elapsed(p, RUNNING);
+  p->stamp = ticks;
+  p->state = state;
+}
+
+// Make p RUNNABLE and queue it for a CPU. p->lock must be
+// held, and if p is SLEEPING, the lock of its wait queue.
+static void
+setrunnable(struct proc *p)
+{
+  struct sleepq *q;
+
+  if(p->state == SLEEPING){
+    q = sleepqueue(p->chan);
+    if(p->slprev)
+      p->slprev->slnext = p->slnext;
+    else
+      q->head = p->slnext;
+    if(p->slnext)
+      p->slnext->slprev = p->slprev;
+    else
+      q->tail = p->slprev;
+    p->slnext = p->slprev = 0;
+    runqwake(p);
+  }
+  setstate(p, RUNNABLE);
+  p->readytsc = rdtsc();
+  runqadd(p);
+}
+
+// Log2 histogram bucket for a delay of d cycles.
+static int
+latbucket(uint64 d)
+{
+  int b;
+
+  for(b = 0; d > 1 && b < NLATBUCKET-1; b++)
+    d >>= 1;
+  return b;
+}
+
+// Record how long p waited between becoming RUNNABLE
+// and being dispatched on c. p->lock must be held.
+static void
+recordlatency(struct cpu *c, struct proc *p)
+{
+  int b;
+
+  b = latbucket(rdtsc() - p->readytsc);
+  c->lathist[b]++;
+  p->lathist[b]++;
+}
+
+// Clear every scheduling latency histogram.
+void
+schedlatreset(void)
 {
   struct proc *p;
+  int i;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    acquire(&p->lock);
+    memset(p->lathist, 0, sizeof(p->lathist));
+    release(&p->lock);
+  }
+  for(i = 0; i < ncpu; i++)
+    memset(cpus[i].lathist, 0, sizeof(cpus[i].lathist));
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  wakeupn(chan, NPROC);
+}
+
+// Wake up the longest sleeper on chan, for channels whose
+// waiters want something only one of them can have, such
+// as a sleeplock.
+void
+wakeup_one(void *chan)
+{
+  wakeupn(chan, 1);
 }
 
 // Kill the process with the given pid.
@@ -635,19 +1227,13 @@ kill(int pid)
 {
   struct proc *p;
 
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
-  }
-  release(&ptable.lock);
-  return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  release(&p->lock);
+  // Wake process from sleep if necessary.
+  wakeproc(p);
+  return 0;
 }
 
 //return ticks running with the given pid
@@ -655,48 +1241,405 @@ int
 ticks_running(int pid)
 {
   struct proc *p;
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if(p->pid == pid) {
-      int ticks = p->ticks;
-      release(&ptable.lock);
-      return ticks;
-    }
+  if((p = findproc(pid)) != 0) {
+    int ticks = p->ticks;
+    release(&p->lock);
+    return ticks;
   }
-  release(&ptable.lock);
   return -1;
 }
 
-void set_lottery_tickets(int tickets, int pid) {
+int
+set_lottery_tickets(int tickets, int pid)
+{
   struct proc *p;
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if(p->pid == pid) {
-      p->lottery_tickets = tickets;
-      release(&ptable.lock);
+  if((p = findproc(pid)) != 0) {
+    p->basetickets = tickets;
+    retick(p);
+    release(&p->lock);
+    return 0;
+  }
+  return -1;
+}
+
+// Restrict process pid to the CPUs whose bits are set in mask.
+// Returns -1 if there is no such process or mask names no CPU.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+  if((p = findproc(pid)) != 0){
+    runqsetaffinity(p, mask);
+    release(&p->lock);
+    return 0;
+  }
+  return -1;
+}
+
+// Return the CPU mask of process pid, or -1 if there is none.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if((p = findproc(pid)) != 0){
+    mask = p->cpumask & ((1 << ncpu) - 1);
+    release(&p->lock);
+    return mask;
+  }
+  return -1;
+}
+
+// Copy the counters of up to max CPUs into cs.
+// Returns the number of entries filled in.
+int
+getcpustat(struct cpustat *cs, int max)
+{
+  int i;
+
+  for(i = 0; i < ncpu && i < max; i++){
+    cs[i].cpu = i;
+    cs[i].idleticks = cpus[i].idleticks;
+    cs[i].busyticks = cpus[i].busyticks;
+    cs[i].pievents = cpus[i].pievents;
+    cs[i].nswitch = cpus[i].nswitch;
+    cs[i].nmigrate = cpus[i].nmigrate;
+    kallocstat(i, &cs[i]);
+    memmove(cs[i].lat, cpus[i].lathist, sizeof(cs[i].lat));
+  }
+  return i;
+}
+
+//PAGEBREAK!
+// Futexes. A futex is keyed by the kernel address of its user
+// word, so every thread sharing the page agrees on the key.
+// Return that address for the word at user address addr,
+// faulting the page in if need be, or 0 if it is not mapped.
+// A page still shared copy-on-write after fork is copied
+// first, so that a later write can't move the word to a
+// frame with a different key.
+static int*
+futexkey(int *addr)
+{
+  struct proc *p = myproc();
+  char *page;
+
+  (void)*(volatile int*)addr;
+  acquire(&p->vm->lock);
+  if(cowfault(p->pgdir, (uint)addr) < 0)
+    page = 0;
+  else
+    page = uva2ka(p->pgdir, (char*)addr);
+  release(&p->vm->lock);
+  if(page == 0)
+    return 0;
+  return (int*)(page + ((uint)addr & (PGSIZE-1)));
+}
+
+// Sleep on the futex at addr if it still holds val.
+// Return -1 at once if it does not.
+int
+futexwait(int *addr, int val)
+{
+  int *key;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  acquire(&futexlock);
+  if(*key != val){
+    release(&futexlock);
+    return -1;
+  }
+  sleep(key, &futexlock);
+  release(&futexlock);
+  return 0;
+}
+
+// Wake up to n processes sleeping on the futex at addr.
+// Return the number woken.
+int
+futexwake(int *addr, int n)
+{
+  int *key, woken;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  acquire(&futexlock);
+  woken = wakeupn(key, n);
+  release(&futexlock);
+  return woken;
+}
+
+//PAGEBREAK!
+// Ticket transfer. Under LOTTERY, a process that blocks
+// waiting on another lends it its tickets, so the process
+// it waits for runs at the waiter's share, and takes them
+// back when it wakes. Lent and inherited tickets are kept
+// apart from a process's own, so that taking them back
+// leaves it with exactly its own, however those changed
+// in the meantime.
+
+// Recompute p's effective tickets. Caller holds p->lock.
+static void
+retick(struct proc *p)
+{
+  runqsettickets(p, p->basetickets + p->lentin + p->piboost);
+}
+
+// Called with to->lock held.
+static void
+lend1(struct proc *from, struct proc *to)
+{
+  if(to == 0 || to == from || from->lentto)
+    return;
+  if(to->state == UNUSED || to->state == ZOMBIE)
+    return;
+  from->lentto = to;
+  from->lentpid = to->pid;
+  from->lent = from->lottery_tickets;
+  to->lentin += from->lent;
+  retick(to);
+}
+
+static void
+return1(struct proc *p)
+{
+  struct proc *to;
+
+  if((to = p->lentto) == 0)
+    return;
+  // Tickets lent to a process that has since exited are gone.
+  acquire(&to->lock);
+  if(to->pid == p->lentpid && to->state != UNUSED && to->state != ZOMBIE){
+    to->lentin -= p->lent;
+    retick(to);
+  }
+  release(&to->lock);
+  p->lentto = 0;
+  p->lent = 0;
+}
+
+// Lend the current process's tickets to process pid
+// until ticketreturn(). No-op unless the policy is LOTTERY.
+void
+ticketlend(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0 || runqpolicy() != SCHED_LOTTERY)
+    return;
+  if((p = findproc(pid)) != 0){
+    lend1(myproc(), p);
+    release(&p->lock);
+  }
+}
+
+// Take back tickets lent by ticketlend().
+void
+ticketreturn(void)
+{
+  return1(myproc());
+}
+
+// Priority inheritance. A process about to block on a
+// sleeplock raises the holder's tickets to its own if they
+// are lower, and the holder keeps them until it has released
+// every sleeplock it holds. It also raises the holder to its
+// MLFQ level if that is higher; the holder then drops back
+// through the levels as it uses its slices, as usual. The
+// caller holds the sleeplock's spinlock, so holder can't go
+// away.
+void
+piboost(struct proc *holder)
+{
+  struct proc *p = myproc();
+  int need, boosted;
+
+  if(holder == 0 || holder == p)
+    return;
+  acquire(&holder->lock);
+  boosted = 0;
+  if(holder->state != ZOMBIE){
+    need = p->lottery_tickets - holder->lottery_tickets;
+    if(need > 0){
+      holder->piboost += need;
+      retick(holder);
+      boosted = 1;
+    }
+    if(runqpolicy() == SCHED_MLFQ && p->level < holder->level){
+      runqsetlevel(holder, p->level);
+      holder->slice = 0;
+      boosted = 1;
     }
   }
-  release(&ptable.lock);
+  if(boosted)
+    mycpu()->pievents++;
+  release(&holder->lock);
+}
+
+// Drop the tickets the current process inherited.
+void
+piunboost(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(p->piboost){
+    p->piboost = 0;
+    retick(p);
+  }
+  release(&p->lock);
+}
+
+// Permanently give n of the current process's tickets to
+// process pid. The caller must keep at least one.
+int
+transfer_tickets(int pid, int n)
+{
+  struct proc *p, *curproc = myproc();
+
+  if(n < 1 || pid == curproc->pid)
+    return -1;
+  acquire(&curproc->lock);
+  if(n >= curproc->basetickets){
+    release(&curproc->lock);
+    return -1;
+  }
+  curproc->basetickets -= n;
+  retick(curproc);
+  release(&curproc->lock);
+
+  if((p = findproc(pid)) != 0 && p->state != ZOMBIE){
+    p->basetickets += n;
+    retick(p);
+    release(&p->lock);
+    return 0;
+  }
+  if(p)
+    release(&p->lock);
+
+  // Nobody to give them to; take them back.
+  acquire(&curproc->lock);
+  curproc->basetickets += n;
+  retick(curproc);
+  release(&curproc->lock);
+  return -1;
+}
+
+//PAGEBREAK!
+// Real-time processes. A real-time process reserves runtime
+// ticks of CPU in every period, due deadline ticks after the
+// period starts; the run queues dispatch them earliest
+// deadline first, ahead of the normal policy (see sched.c).
+
+// A real-time process's share of a CPU, in per mille.
+static int
+rtdensity(struct proc *p)
+{
+  if(p->rtruntime == 0)
+    return 0;
+  return (p->rtruntime * 1000 + p->rtdeadline - 1) / p->rtdeadline;
+}
+
+// Make the current process real-time, or return it to the
+// normal policy if runtime is 0. A deadline of 0 means the
+// end of the period. Admission control refuses the request
+// if the real-time processes' total density would exceed
+// RTMAXUTIL per mille, so that even if they all share one
+// CPU, EDF meets every deadline. Children are not real-time.
+int
+setrt(int runtime, int period, int deadline)
+{
+  struct proc *p = myproc();
+  int old, bw;
+
+  if(deadline == 0)
+    deadline = period;
+  if(runtime < 0 || runtime > 1000000 ||
+     (runtime > 0 && (runtime > deadline || deadline > period)))
+    return -1;
+
+  bw = runtime > 0 ? (runtime * 1000 + deadline - 1) / deadline : 0;
+  acquire(&rtlock);
+  old = rtdensity(p);
+  if(rtbw - old + bw > RTMAXUTIL){
+    release(&rtlock);
+    return -1;
+  }
+  rtbw += bw - old;
+  // We are running, so on no run queue, and wakeupn() sees
+  // the class change under p->lock. Leaving the class clears
+  // the job too, so nothing is left throttled.
+  acquire(&p->lock);
+  p->rtruntime = runtime;
+  p->rtperiod = runtime > 0 ? period : 0;
+  p->rtdeadline = runtime > 0 ? deadline : 0;
+  p->rtdl = ticks + p->rtdeadline;
+  p->rtbudget = runtime;
+  p->rtthrottled = 0;
+  p->rtmissed = 0;
+  release(&p->lock);
+  release(&rtlock);
+  return 0;
+}
+
+// Sleep until the current process's real-time budget is
+// replenished at the start of its next period. The clock's
+// wakeups leave it asleep until then (see wakeupn), so it
+// stays off the run queues while throttled.
+void
+rtthrottle(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&tickslock);
+  while(p->rtthrottled && !p->killed)
+    sleep(&ticks, &tickslock);
+  release(&tickslock);
+}
+
+// Switch the scheduling policy; see runqsetpolicy.
+int
+setsched(int policy)
+{
+  return runqsetpolicy(policy);
 }
 
 int get_lottery_tickets(int pid) {
   struct proc *p;
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if(p->pid == pid) {
-      int tickets = p->lottery_tickets;
-      release(&ptable.lock);
-      return tickets;
-    }
+  if((p = findproc(pid)) != 0) {
+    int tickets = p->state == ZOMBIE ? -1 : p->lottery_tickets;
+    release(&p->lock);
+    return tickets;
   }
-  release(&ptable.lock);
   return -1;
 }
 
-int get_random(int min, int max) {
+// Return a pseudo-random number in [min, max), drawn from
+// this CPU's xorshift32 generator.
+int
+get_random(int min, int max)
+{
+  struct cpu *c;
+  uint x;
   int range = max - min;
-  if(range==0) return min;
-  return min + (ticks % range);
+
+  if(range <= 0)
+    return min;
+  pushcli();
+  c = mycpu();
+  x = c->rand;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  c->rand = x;
+  popcli();
+  return min + x % range;
 }
 
 //PAGEBREAK: 36
@@ -726,7 +1669,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s level %d", p->pid, state, p->name, p->level);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -734,18 +1677,8 @@ procdump(void)
     }
     cprintf("\n");
   }
-}
-struct proc* get_proc(int pid) {
-  struct proc *p;
-  acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if (p->pid == pid && p-> state !=UNUSED) {
-      release(&ptable.lock);
-      return p;
-    }
-  }
-  release(&ptable.lock);
-  return 0;
+  kmemdump();
+  slabdump();
 }
 struct proc *getptable_proc(void) {
   return ptable.proc;
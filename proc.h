@@ -3,6 +3,24 @@
 
 #define DEFAULT_TICKETS 1
 #include "mmu.h"
+#include "spinlock.h"
+
+// Address space, shared by threads made by clone(); see proc.c.
+struct vm {
+  int ref;
+  struct proc *procs;          // Processes using it, by vmnext
+  struct spinlock lock;        // Serializes page faults
+};
+
+// Open files and current directory, shared by threads made
+// by clone().
+struct files {
+  struct spinlock lock;        // Protects everything below
+  int ref;                     // Processes sharing the table
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -13,6 +31,14 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  uint rand;                   // xorshift32 state for get_random()
+  volatile uint halted;        // Is the scheduler halted waiting for work?
+  uint idleticks;              // Timer ticks with no process running
+  uint busyticks;              // Timer ticks with a process running
+  uint lathist[NLATBUCKET];    // Latency of our dispatches, log2 cycles
+  uint pievents;               // Priority inheritance boosts made here
+  uint nswitch;                // Context switches into processes
+  uint nmigrate;               // Dispatches of processes last run elsewhere
 };
 
 extern struct cpu cpus[NCPU];
@@ -41,26 +67,77 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
+  struct spinlock lock;        // Protects state, chan and killed
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
+  struct vm *vm;               // Address space, shared by threads
+  struct proc *vmnext;         // Next process sharing vm
+  uint ustack;                 // Thread's user stack, from clone()
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // Children still running
+  struct proc *zombies;        // Children that have exited
+  struct proc *sibnext;        // Links on parent's children or zombies
+  struct proc *sibprev;
+  int nchild;                  // Children, not counting threads
+  int nthread;                 // Threads made by clone(), not yet joined
+  int thread;                  // Made by clone(), for join() to reap
+  struct proc *hnext;          // Pid hash chain, or free list link
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *slnext;         // Wait queue links (see sleep)
+  struct proc *slprev;
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and cwd, shared by threads
   char name[16];               // Process name (debugging)
-  int ticks;
+  int ticks;                   // Clock ticks spent running
   uint ctime;                  //Process creation time
   int stime;                   //process SLEEPING time
   int retime;                  //process READY(RUNNABLE) time
   int rutime;                  //process RUNNING time
-  int fifo_position;
-  int lottery_tickets;          
+  uint stamp;                  // ticks at last state change
+  int firstrun;                // ticks at first dispatch, or -1
+  uint64 readytsc;             // TSC when last made RUNNABLE
+  uint lathist[NLATBUCKET];    // Scheduling latency, log2 cycles
+  int lottery_tickets;         // Effective: basetickets + lentin + piboost
+  int basetickets;             // Our own, from set/transfer_tickets
+  struct proc *lentto;         // Holder of tickets we lent while blocked
+  int lentpid;                 // Its pid, in case it has exited
+  int lent;                    // Number of tickets lent
+  int lentin;                  // Tickets lent to us by blocked waiters
+  int piboost;                 // Tickets inherited from sleeplock waiters
+  int nsleeplocks;             // Sleeplocks held
+  struct proc *rqnext;         // Run queue links (see sched.c)
+  struct proc *rqprev;
+  int rqcpu;                   // CPU whose run queue holds us, or -1
+  int lastcpu;                 // CPU we last ran on, or -1
+  uint lastrun;                // When we last stopped running, in ticks
+  uint cpumask;                // CPUs we may run on, one bit each
+  int heapidx;                 // Index in run queue heap, or -1
+  uint pass;                   // Stride scheduling pass
+  struct proc *qnext;          // MLFQ level queue links
+  struct proc *qprev;
+  int level;                   // MLFQ priority level, 0 is highest
+  int slice;                   // Ticks used at the current level
+  uint epoch;                  // MLFQ boost period last applied
+  uint vruntime;               // CFS weighted virtual runtime
+  int runticks;                // Ticks run since last dispatched
+  struct proc *rbleft;         // CFS run queue tree links
+  struct proc *rbright;
+  struct proc *rbparent;
+  int rbred;
+  int rtruntime;               // EDF budget per period, or 0 if not real-time
+  int rtperiod;                // EDF period, in ticks
+  int rtdeadline;              // EDF deadline, ticks after period start
+  uint rtdl;                   // Absolute deadline of the current job
+  int rtbudget;                // Budget left in the current job
+  int rtthrottled;             // Out of budget until the next period
+  int rtmissed;                // Current job has missed its deadline
+  int rtmisses;                // Deadline misses
+  struct proc *edfnext;        // EDF run queue link
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,32 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+char *states[] = { "unused", "embryo", "sleep ", "runble", "run   ", "zombie" };
+
+struct procstat ps[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  n = getpinfo(ps, NPROC);
+  if(n < 0){
+    printf(2, "ps: getpinfo failed\n");
+    exit();
+  }
+  printf(1, "PID\tPPID\tSTATE\tTICKETS\tRUN\tREADY\tSLEEP\tRESP\tMISS\tNAME\n");
+  for(i = 0; i < n; i++){
+    printf(1, "%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t",
+           ps[i].pid, ps[i].ppid, states[ps[i].state], ps[i].tickets,
+           ps[i].rutime, ps[i].retime, ps[i].stime, ps[i].rsptime);
+    if(ps[i].rtperiod)
+      printf(1, "%d\t%s\n", ps[i].rtmisses, ps[i].name);
+    else
+      printf(1, "-\t%s\n", ps[i].name);
+  }
+  exit();
+}
@@ -0,0 +1,38 @@
+// Process statistics, filled in by getpinfo().
+// Times are in clock ticks. Needs param.h.
+struct procstat {
+  int pid;
+  int ppid;          // Parent's pid, or 0
+  int state;         // enum procstate in proc.h
+  char name[16];
+  int tickets;       // lottery_tickets
+  int ticks;         // Ticks spent running
+  uint ctime;        // Creation time
+  int retime;        // Time RUNNABLE, waiting for a CPU
+  int rutime;        // Time RUNNING
+  int stime;         // Time SLEEPING
+  int rsptime;       // Creation to first run, or -1 if not yet run
+  int rtperiod;      // Real-time period, or 0 if not real-time
+  int rtmisses;      // Real-time deadline misses
+  uint lat[NLATBUCKET]; // Scheduling latency histogram, see below
+};
+
+// Per-CPU statistics, filled in by getcpustat().
+struct cpustat {
+  int cpu;
+  uint idleticks;    // Timer ticks with no process running
+  uint busyticks;    // Timer ticks with a process running
+  uint pievents;     // Sleeplock priority inheritance boosts
+  uint nswitch;      // Context switches into processes
+  uint nmigrate;     // Dispatches of processes last run on another CPU
+  uint kmhits;       // kalloc() calls served from this CPU's page cache
+  uint kmmisses;     // kalloc() calls that took the global free list lock
+  uint zhits;        // kalloc_zeroed() calls served from the zero pool
+  uint zmisses;      // kalloc_zeroed() calls that had to zero a page
+  uint lat[NLATBUCKET]; // Latency of dispatches made by this CPU
+};
+
+// Scheduling latency is the time from a process becoming
+// RUNNABLE to being dispatched. lat[i] counts delays of
+// [2^i, 2^(i+1)) TSC cycles; the last bucket also counts
+// anything longer. schedlatreset() clears every histogram.
@@ -0,0 +1,1129 @@
+// Per-CPU run queues.
+//
+// Every RUNNABLE process sits on exactly one CPU's run queue.
+// Each queue has its own lock and keeps its processes on a
+// doubly-linked list in arrival order; the scheduling policy
+// decides which queued process runs next. SCHEDULER= picks the
+// policy at boot and setsched() can change it at run time.
+// Real-time processes (see setrt) bypass the policy: each queue
+// keeps them on a list by deadline and dispatches them first.
+// A process is queued on the CPU it last ran on, and a CPU
+// whose own queue is empty steals from the busiest other queue,
+// skipping processes still cache-hot where they last ran.
+//
+// Locking: callers hold p->lock, which protects p->state.
+// A run queue's lock protects its list and the rq fields of
+// the processes on it. Lock order is p->lock, then rq->lock.
+// A CPU takes a process off a queue without its p->lock, so
+// p->rqcpu may change under a caller that holds only p->lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sched.h"
+#include "traps.h"
+
+struct runq {
+  struct spinlock lock;
+  int nready;                // Number of queued processes
+  struct proc *head;         // Queued processes, oldest first
+  struct proc *tail;
+  int total;                 // Sum of queued lottery tickets
+  int fenwick[NPROC+1];      // Ticket index by proc slot (LOTTERY)
+  struct proc *heap[NPROC];  // Min-heap on pass (STRIDE)
+  int nheap;
+  uint vpass;                // Pass of the last process dispatched
+  struct proc *lhead[NMLFQ]; // Per-level queues (MLFQ)
+  struct proc *ltail[NMLFQ];
+  uint epoch;                // Last boost applied to the levels
+  struct proc *rbroot;       // Red-black tree on vruntime (CFS)
+  struct proc *rbleftmost;   // Its minimum, cached
+  uint minvruntime;          // Floor for joining processes
+  struct proc *edfhead;      // Real-time processes by deadline
+};
+
+// A scheduling policy plugs in behind the run queue.
+// enqueue and dequeue are called with rq->lock held, after
+// p is linked onto the queue and before it is unlinked;
+// pick returns the queued process that should run next.
+// tick is called on each timer interrupt that finds p running
+// on rq's CPU, and returns nonzero if p should give up the CPU.
+struct schedpolicy {
+  char *name;
+  void (*enqueue)(struct runq*, struct proc*);
+  void (*dequeue)(struct runq*, struct proc*);
+  struct proc* (*pick)(struct runq*);
+  int (*tick)(struct runq*, struct proc*);
+};
+
+static struct runq runqs[NCPU];
+static struct proc *proctab;  // ptable.proc, to map procs to slots
+
+//PAGEBREAK!
+// Round robin: run queued processes in arrival order.
+static void
+rr_enqueue(struct runq *rq, struct proc *p)
+{
+}
+
+static void
+rr_dequeue(struct runq *rq, struct proc *p)
+{
+}
+
+static struct proc*
+rr_pick(struct runq *rq)
+{
+  return rq->head;
+}
+
+static int
+rr_tick(struct runq *rq, struct proc *p)
+{
+  return 1;
+}
+
+// First come first served: run queued processes in the order
+// they became runnable, and never preempt on the clock; a
+// process keeps its CPU until it sleeps or exits.
+static int
+fifo_tick(struct runq *rq, struct proc *p)
+{
+  return 0;
+}
+
+// Lottery: draw a ticket among the queued processes.
+// Each queue indexes its tickets in a Fenwick tree keyed by
+// process slot, so both the update on enqueue/dequeue and the
+// draw are O(log NPROC).
+static void
+fenwick_add(struct runq *rq, int slot, int delta)
+{
+  int i;
+
+  rq->total += delta;
+  for(i = slot + 1; i <= NPROC; i += i & -i)
+    rq->fenwick[i] += delta;
+}
+
+// Return the slot holding the n'th ticket, 0 <= n < rq->total.
+static int
+fenwick_find(struct runq *rq, int n)
+{
+  int pos, step;
+
+  for(step = 1; step*2 <= NPROC; step *= 2)
+    ;
+  pos = 0;
+  for(; step > 0; step /= 2){
+    if(pos + step <= NPROC && rq->fenwick[pos + step] <= n){
+      pos += step;
+      n -= rq->fenwick[pos];
+    }
+  }
+  return pos;
+}
+
+static void
+lottery_enqueue(struct runq *rq, struct proc *p)
+{
+  fenwick_add(rq, p - proctab, p->lottery_tickets);
+}
+
+static void
+lottery_dequeue(struct runq *rq, struct proc *p)
+{
+  fenwick_add(rq, p - proctab, -p->lottery_tickets);
+}
+
+static struct proc*
+lottery_pick(struct runq *rq)
+{
+  if(rq->total <= 0)
+    return rq->head;
+  return &proctab[fenwick_find(rq, get_random(0, rq->total))];
+}
+
+//PAGEBREAK!
+// Stride: each process advances its pass by STRIDE1/tickets
+// for every tick it runs, and the lowest pass runs next.
+// Passes wrap, so compare them by signed difference.
+#define STRIDE1 (1 << 16)
+
+static int
+passbefore(uint a, uint b)
+{
+  return (int)(a - b) < 0;
+}
+
+static void
+heapswap(struct runq *rq, int i, int j)
+{
+  struct proc *t;
+
+  t = rq->heap[i];
+  rq->heap[i] = rq->heap[j];
+  rq->heap[j] = t;
+  rq->heap[i]->heapidx = i;
+  rq->heap[j]->heapidx = j;
+}
+
+static void
+heapup(struct runq *rq, int i)
+{
+  while(i > 0 && passbefore(rq->heap[i]->pass, rq->heap[(i-1)/2]->pass)){
+    heapswap(rq, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+heapdown(struct runq *rq, int i)
+{
+  int m, c;
+
+  for(;;){
+    m = i;
+    for(c = 2*i+1; c <= 2*i+2 && c < rq->nheap; c++)
+      if(passbefore(rq->heap[c]->pass, rq->heap[m]->pass))
+        m = c;
+    if(m == i)
+      break;
+    heapswap(rq, i, m);
+    i = m;
+  }
+}
+
+static void
+stride_enqueue(struct runq *rq, struct proc *p)
+{
+  // A process joining or waking up starts at the queue's
+  // current pass, so time spent away earns it no credit.
+  if(passbefore(p->pass, rq->vpass))
+    p->pass = rq->vpass;
+  p->heapidx = rq->nheap;
+  rq->heap[rq->nheap++] = p;
+  heapup(rq, p->heapidx);
+}
+
+static void
+stride_dequeue(struct runq *rq, struct proc *p)
+{
+  int i;
+
+  i = p->heapidx;
+  rq->nheap--;
+  if(i != rq->nheap){
+    heapswap(rq, i, rq->nheap);
+    heapup(rq, i);
+    heapdown(rq, i);
+  }
+  p->heapidx = -1;
+}
+
+static struct proc*
+stride_pick(struct runq *rq)
+{
+  if(rq->nheap == 0)
+    return 0;
+  rq->vpass = rq->heap[0]->pass;
+  return rq->heap[0];
+}
+
+static int
+stride_tick(struct runq *rq, struct proc *p)
+{
+  p->pass += STRIDE1 / (p->lottery_tickets > 0 ? p->lottery_tickets : 1);
+  return 1;
+}
+
+//PAGEBREAK!
+// Multi-level feedback queue: run the head of the highest
+// non-empty level. A process that uses up its level's quantum
+// (MLFQQUANTUM << level ticks, counted across sleeps) drops a
+// level. Every MLFQBOOST ticks all processes return to level 0,
+// applied lazily when each process or queue is next touched.
+static uint
+mlfq_epoch(void)
+{
+  return ticks / MLFQBOOST;
+}
+
+static void
+mlfq_refresh(struct proc *p)
+{
+  if(p->epoch != mlfq_epoch()){
+    p->epoch = mlfq_epoch();
+    p->level = 0;
+    p->slice = 0;
+  }
+}
+
+static void
+mlfq_link(struct runq *rq, struct proc *p)
+{
+  p->qnext = 0;
+  p->qprev = rq->ltail[p->level];
+  if(rq->ltail[p->level])
+    rq->ltail[p->level]->qnext = p;
+  else
+    rq->lhead[p->level] = p;
+  rq->ltail[p->level] = p;
+}
+
+static void
+mlfq_enqueue(struct runq *rq, struct proc *p)
+{
+  mlfq_refresh(p);
+  mlfq_link(rq, p);
+}
+
+static void
+mlfq_dequeue(struct runq *rq, struct proc *p)
+{
+  if(p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    rq->lhead[p->level] = p->qnext;
+  if(p->qnext)
+    p->qnext->qprev = p->qprev;
+  else
+    rq->ltail[p->level] = p->qprev;
+  p->qnext = p->qprev = 0;
+}
+
+static struct proc*
+mlfq_pick(struct runq *rq)
+{
+  struct proc *p, *next;
+  int l;
+
+  if(rq->epoch != mlfq_epoch()){
+    rq->epoch = mlfq_epoch();
+    for(l = 1; l < NMLFQ; l++){
+      for(p = rq->lhead[l]; p; p = next){
+        next = p->qnext;
+        if(p->epoch == rq->epoch)
+          continue;  // demoted again since the boost
+        mlfq_dequeue(rq, p);
+        mlfq_refresh(p);
+        mlfq_link(rq, p);
+      }
+    }
+  }
+  for(l = 0; l < NMLFQ; l++)
+    if(rq->lhead[l])
+      return rq->lhead[l];
+  return 0;
+}
+
+static int
+mlfq_tick(struct runq *rq, struct proc *p)
+{
+  int l;
+
+  mlfq_refresh(p);
+  if(++p->slice >= (MLFQQUANTUM << p->level)){
+    if(p->level < NMLFQ-1)
+      p->level++;
+    p->slice = 0;
+    return 1;
+  }
+  // Give way if a higher level has work waiting here.
+  for(l = 0; l < p->level; l++)
+    if(rq->lhead[l])
+      return 1;
+  return 0;
+}
+
+//PAGEBREAK!
+// Completely fair: each process accrues virtual runtime at a
+// rate inversely proportional to its weight (lottery_tickets),
+// and the process with the least vruntime runs next. Runnable
+// processes live in a red-black tree ordered by vruntime. A
+// running process is preempted only after CFSMINGRAN ticks,
+// and only if someone queued has less vruntime.
+#define CFSUNIT 1024  // vruntime per tick at weight INTIAL_TICKETS
+
+static int
+cfsbefore(struct proc *a, struct proc *b)
+{
+  if(a->vruntime != b->vruntime)
+    return passbefore(a->vruntime, b->vruntime);
+  return a < b;
+}
+
+static void
+rbrotleft(struct runq *rq, struct proc *x)
+{
+  struct proc *y = x->rbright;
+
+  x->rbright = y->rbleft;
+  if(y->rbleft)
+    y->rbleft->rbparent = x;
+  y->rbparent = x->rbparent;
+  if(x->rbparent == 0)
+    rq->rbroot = y;
+  else if(x == x->rbparent->rbleft)
+    x->rbparent->rbleft = y;
+  else
+    x->rbparent->rbright = y;
+  y->rbleft = x;
+  x->rbparent = y;
+}
+
+static void
+rbrotright(struct runq *rq, struct proc *x)
+{
+  struct proc *y = x->rbleft;
+
+  x->rbleft = y->rbright;
+  if(y->rbright)
+    y->rbright->rbparent = x;
+  y->rbparent = x->rbparent;
+  if(x->rbparent == 0)
+    rq->rbroot = y;
+  else if(x == x->rbparent->rbright)
+    x->rbparent->rbright = y;
+  else
+    x->rbparent->rbleft = y;
+  y->rbright = x;
+  x->rbparent = y;
+}
+
+static int
+rbisred(struct proc *x)
+{
+  return x && x->rbred;
+}
+
+static void
+rbinsert(struct runq *rq, struct proc *z)
+{
+  struct proc **link, *parent, *x, *g, *u;
+  int leftmost;
+
+  parent = 0;
+  link = &rq->rbroot;
+  leftmost = 1;
+  while(*link){
+    parent = *link;
+    if(cfsbefore(z, parent))
+      link = &parent->rbleft;
+    else {
+      link = &parent->rbright;
+      leftmost = 0;
+    }
+  }
+  z->rbleft = z->rbright = 0;
+  z->rbparent = parent;
+  z->rbred = 1;
+  *link = z;
+  if(leftmost)
+    rq->rbleftmost = z;
+
+  while((x = z->rbparent) != 0 && x->rbred){
+    g = x->rbparent;
+    if(x == g->rbleft){
+      u = g->rbright;
+      if(rbisred(u)){
+        x->rbred = u->rbred = 0;
+        g->rbred = 1;
+        z = g;
+        continue;
+      }
+      if(z == x->rbright){
+        rbrotleft(rq, x);
+        z = x;
+        x = z->rbparent;
+      }
+      x->rbred = 0;
+      g->rbred = 1;
+      rbrotright(rq, g);
+    } else {
+      u = g->rbleft;
+      if(rbisred(u)){
+        x->rbred = u->rbred = 0;
+        g->rbred = 1;
+        z = g;
+        continue;
+      }
+      if(z == x->rbleft){
+        rbrotright(rq, x);
+        z = x;
+        x = z->rbparent;
+      }
+      x->rbred = 0;
+      g->rbred = 1;
+      rbrotleft(rq, g);
+    }
+  }
+  rq->rbroot->rbred = 0;
+}
+
+// Replace subtree u with subtree v.
+static void
+rbtransplant(struct runq *rq, struct proc *u, struct proc *v)
+{
+  if(u->rbparent == 0)
+    rq->rbroot = v;
+  else if(u == u->rbparent->rbleft)
+    u->rbparent->rbleft = v;
+  else
+    u->rbparent->rbright = v;
+  if(v)
+    v->rbparent = u->rbparent;
+}
+
+static struct proc*
+rbmin(struct proc *x)
+{
+  while(x->rbleft)
+    x = x->rbleft;
+  return x;
+}
+
+static void
+rbdelete(struct runq *rq, struct proc *z)
+{
+  struct proc *x, *xp, *y, *w;
+  int yred;
+
+  if(rq->rbleftmost == z)
+    rq->rbleftmost = z->rbright ? rbmin(z->rbright) : z->rbparent;
+
+  yred = z->rbred;
+  if(z->rbleft == 0){
+    x = z->rbright;
+    xp = z->rbparent;
+    rbtransplant(rq, z, x);
+  } else if(z->rbright == 0){
+    x = z->rbleft;
+    xp = z->rbparent;
+    rbtransplant(rq, z, x);
+  } else {
+    y = rbmin(z->rbright);
+    yred = y->rbred;
+    x = y->rbright;
+    if(y->rbparent == z)
+      xp = y;
+    else {
+      xp = y->rbparent;
+      rbtransplant(rq, y, x);
+      y->rbright = z->rbright;
+      y->rbright->rbparent = y;
+    }
+    rbtransplant(rq, z, y);
+    y->rbleft = z->rbleft;
+    y->rbleft->rbparent = y;
+    y->rbred = z->rbred;
+  }
+  z->rbleft = z->rbright = z->rbparent = 0;
+  if(yred)
+    return;
+
+  // x carries an extra black; push it up or rebalance.
+  while(x != rq->rbroot && !rbisred(x)){
+    if(x == xp->rbleft){
+      w = xp->rbright;
+      if(w->rbred){
+        w->rbred = 0;
+        xp->rbred = 1;
+        rbrotleft(rq, xp);
+        w = xp->rbright;
+      }
+      if(!rbisred(w->rbleft) && !rbisred(w->rbright)){
+        w->rbred = 1;
+        x = xp;
+        xp = x->rbparent;
+      } else {
+        if(!rbisred(w->rbright)){
+          w->rbleft->rbred = 0;
+          w->rbred = 1;
+          rbrotright(rq, w);
+          w = xp->rbright;
+        }
+        w->rbred = xp->rbred;
+        xp->rbred = 0;
+        w->rbright->rbred = 0;
+        rbrotleft(rq, xp);
+        x = rq->rbroot;
+      }
+    } else {
+      w = xp->rbleft;
+      if(w->rbred){
+        w->rbred = 0;
+        xp->rbred = 1;
+        rbrotright(rq, xp);
+        w = xp->rbleft;
+      }
+      if(!rbisred(w->rbleft) && !rbisred(w->rbright)){
+        w->rbred = 1;
+        x = xp;
+        xp = x->rbparent;
+      } else {
+        if(!rbisred(w->rbleft)){
+          w->rbright->rbred = 0;
+          w->rbred = 1;
+          rbrotleft(rq, w);
+          w = xp->rbleft;
+        }
+        w->rbred = xp->rbred;
+        xp->rbred = 0;
+        w->rbleft->rbred = 0;
+        rbrotright(rq, xp);
+        x = rq->rbroot;
+      }
+    }
+  }
+  if(x)
+    x->rbred = 0;
+}
+
+static void
+cfs_enqueue(struct runq *rq, struct proc *p)
+{
+  // Don't let a process that slept or moved here
+  // bank runtime ahead of those already queued.
+  if(passbefore(p->vruntime, rq->minvruntime))
+    p->vruntime = rq->minvruntime;
+  rbinsert(rq, p);
+}
+
+static void
+cfs_dequeue(struct runq *rq, struct proc *p)
+{
+  rbdelete(rq, p);
+}
+
+static struct proc*
+cfs_pick(struct runq *rq)
+{
+  struct proc *p;
+
+  if((p = rq->rbleftmost) != 0 && passbefore(rq->minvruntime, p->vruntime))
+    rq->minvruntime = p->vruntime;
+  return p;
+}
+
+static int
+cfs_tick(struct runq *rq, struct proc *p)
+{
+  struct proc *next;
+  uint delta;
+
+  // At least 1, or a heavy enough process would never
+  // fall behind the rest and would keep the CPU.
+  delta = CFSUNIT * INTIAL_TICKETS /
+    (p->lottery_tickets > 0 ? p->lottery_tickets : 1);
+  p->vruntime += delta > 0 ? delta : 1;
+  if(p->runticks < CFSMINGRAN)
+    return 0;
+  next = rq->rbleftmost;
+  return next != 0 && passbefore(next->vruntime, p->vruntime);
+}
+
+//PAGEBREAK!
+// Earliest deadline first, for real-time processes. Budgets
+// follow the constant bandwidth server: a process that uses
+// up its runtime is throttled until its next period, and one
+// that wakes with more budget left than its share of the time
+// to its deadline starts a fresh job, so no process can take
+// more than its reservation.
+static void
+edf_insert(struct runq *rq, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &rq->edfhead; *pp; pp = &(*pp)->edfnext)
+    if(passbefore(p->rtdl, (*pp)->rtdl))
+      break;
+  p->edfnext = *pp;
+  *pp = p;
+}
+
+static void
+edf_remove(struct runq *rq, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &rq->edfhead; *pp; pp = &(*pp)->edfnext)
+    if(*pp == p){
+      *pp = p->edfnext;
+      break;
+    }
+  p->edfnext = 0;
+}
+
+// Count a miss if p's current job is past its deadline with
+// budget left, once per job.
+static void
+edf_checkmiss(struct proc *p)
+{
+  if(p->rtbudget > 0 && !p->rtmissed && !passbefore(ticks, p->rtdl)){
+    p->rtmissed = 1;
+    p->rtmisses++;
+  }
+}
+
+static void
+edf_newjob(struct proc *p, uint start)
+{
+  p->rtdl = start + p->rtdeadline;
+  p->rtbudget = p->rtruntime;
+  p->rtmissed = 0;
+}
+
+static int
+edf_tick(struct runq *rq, struct proc *p)
+{
+  p->rtbudget--;
+  edf_checkmiss(p);
+  if(p->rtbudget <= 0){
+    p->rtthrottled = 1;
+    return 1;
+  }
+  return rq->edfhead != 0 && passbefore(rq->edfhead->rtdl, p->rtdl);
+}
+
+static struct schedpolicy rr_policy = {
+  "RR", rr_enqueue, rr_dequeue, rr_pick, rr_tick
+};
+static struct schedpolicy fifo_policy = {
+  "FIFO", rr_enqueue, rr_dequeue, rr_pick, fifo_tick
+};
+static struct schedpolicy lottery_policy = {
+  "LOTTERY", lottery_enqueue, lottery_dequeue, lottery_pick, rr_tick
+};
+static struct schedpolicy stride_policy = {
+  "STRIDE", stride_enqueue, stride_dequeue, stride_pick, stride_tick
+};
+static struct schedpolicy mlfq_policy = {
+  "MLFQ", mlfq_enqueue, mlfq_dequeue, mlfq_pick, mlfq_tick
+};
+static struct schedpolicy cfs_policy = {
+  "CFS", cfs_enqueue, cfs_dequeue, cfs_pick, cfs_tick
+};
+
+static struct schedpolicy *policies[NSCHED] = {
+[SCHED_RR]      &rr_policy,
+[SCHED_FIFO]    &fifo_policy,
+[SCHED_LOTTERY] &lottery_policy,
+[SCHED_STRIDE]  &stride_policy,
+[SCHED_MLFQ]    &mlfq_policy,
+[SCHED_CFS]     &cfs_policy,
+};
+
+#if defined(FIFO)
+static struct schedpolicy *policy = &fifo_policy;
+#elif defined(LOTTERY)
+static struct schedpolicy *policy = &lottery_policy;
+#elif defined(STRIDE)
+static struct schedpolicy *policy = &stride_policy;
+#elif defined(MLFQ)
+static struct schedpolicy *policy = &mlfq_policy;
+#elif defined(CFS)
+static struct schedpolicy *policy = &cfs_policy;
+#else
+static struct schedpolicy *policy = &rr_policy;
+#endif
+
+//PAGEBREAK!
+void
+schedinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  proctab = getptable_proc();
+}
+
+// Link p onto rq. Caller holds rq->lock.
+static void
+rqinsert(struct runq *rq, struct proc *p)
+{
+  p->rqnext = 0;
+  p->rqprev = rq->tail;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  p->rqcpu = rq - runqs;
+  rq->nready++;
+  if(p->rtruntime)
+    edf_insert(rq, p);
+  else
+    policy->enqueue(rq, p);
+}
+
+// Unlink p from rq. Caller holds rq->lock.
+static void
+rqremove(struct runq *rq, struct proc *p)
+{
+  if(p->rtruntime)
+    edf_remove(rq, p);
+  else
+    policy->dequeue(rq, p);
+  if(p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    rq->head = p->rqnext;
+  if(p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    rq->tail = p->rqprev;
+  p->rqnext = p->rqprev = 0;
+  p->rqcpu = -1;
+  rq->nready--;
+}
+
+#define ALLOWED(p, cpu) ((p)->cpumask & (1 << (cpu)))
+
+// p was just queued on cpu. If cpu is halted, wake it up;
+// otherwise wake some halted CPU that could steal p.
+static void
+kick(int cpu, struct proc *p)
+{
+  int i;
+
+  if(!cpus[cpu].halted)
+    for(i = 0; i < ncpu; i++)
+      if(cpus[i].halted && ALLOWED(p, i)){
+        cpu = i;
+        break;
+      }
+  if(cpus[cpu].halted)
+    lapicipi(cpus[cpu].apicid, T_WAKEUP);
+}
+
+// Queue a RUNNABLE process on the run queue of the CPU it
+// last ran on, whose cache may still hold its working set;
+// failing that on this CPU's, or on the least loaded CPU in
+// its affinity mask. Caller holds p->lock.
+void
+runqadd(struct proc *p)
+{
+  struct runq *rq;
+  int i, cpu;
+
+  if(p->state != RUNNABLE)
+    panic("runqadd");
+  cpu = p->lastcpu;
+  if(cpu < 0 || cpu >= ncpu || !ALLOWED(p, cpu))
+    cpu = cpuid();
+  if(!ALLOWED(p, cpu)){
+    cpu = -1;
+    for(i = 0; i < ncpu; i++)
+      if(ALLOWED(p, i) && (cpu < 0 || runqs[i].nready < runqs[cpu].nready))
+        cpu = i;
+    if(cpu < 0)
+      panic("runqadd mask");
+  }
+  rq = &runqs[cpu];
+  acquire(&rq->lock);
+  rqinsert(rq, p);
+  release(&rq->lock);
+  kick(cpu, p);
+}
+
+// Lock and return the run queue p is on, or return 0 if p
+// is not queued. Caller holds p->lock.
+static struct runq*
+rqlock(struct proc *p)
+{
+  struct runq *rq;
+  int cpu;
+
+  while((cpu = p->rqcpu) >= 0){
+    rq = &runqs[cpu];
+    acquire(&rq->lock);
+    if(p->rqcpu == cpu)
+      return rq;
+    release(&rq->lock);
+  }
+  return 0;
+}
+
+// Restrict p to the CPUs in mask, moving it to another
+// run queue if it is queued outside the mask.
+// Caller holds p->lock.
+void
+runqsetaffinity(struct proc *p, uint mask)
+{
+  struct runq *rq;
+
+  p->cpumask = mask;
+  if((rq = rqlock(p)) == 0)
+    return;
+  if(ALLOWED(p, p->rqcpu)){
+    release(&rq->lock);
+    return;
+  }
+  rqremove(rq, p);
+  release(&rq->lock);
+  runqadd(p);
+}
+
+// Change p's tickets, keeping its run queue's index in step.
+// Caller holds p->lock.
+void
+runqsettickets(struct proc *p, int tickets)
+{
+  struct runq *rq;
+
+  if(p->rtruntime || (rq = rqlock(p)) == 0){
+    p->lottery_tickets = tickets;
+    return;
+  }
+  policy->dequeue(rq, p);
+  p->lottery_tickets = tickets;
+  policy->enqueue(rq, p);
+  release(&rq->lock);
+}
+
+// Move p to MLFQ level, keeping its run queue in step.
+// Caller holds p->lock.
+void
+runqsetlevel(struct proc *p, int level)
+{
+  struct runq *rq;
+
+  if(p->rtruntime || (rq = rqlock(p)) == 0){
+    p->level = level;
+    return;
+  }
+  policy->dequeue(rq, p);
+  p->level = level;
+  policy->enqueue(rq, p);
+  release(&rq->lock);
+}
+
+// Switch every run queue to scheduling policy id and
+// return the previous policy, or -1 if id is not valid.
+// Queued processes are handed from the old policy's
+// structures to the new one's, in arrival order.
+int
+runqsetpolicy(int id)
+{
+  struct runq *rq;
+  struct proc *p;
+  int old;
+
+  if(id < 0 || id >= NSCHED)
+    return -1;
+  old = runqpolicy();
+  for(rq = runqs; rq < &runqs[NCPU]; rq++)
+    acquire(&rq->lock);
+  for(rq = runqs; rq < &runqs[NCPU]; rq++)
+    for(p = rq->head; p; p = p->rqnext)
+      if(!p->rtruntime)
+        policy->dequeue(rq, p);
+  policy = policies[id];
+  for(rq = runqs; rq < &runqs[NCPU]; rq++)
+    for(p = rq->head; p; p = p->rqnext)
+      if(!p->rtruntime)
+        policy->enqueue(rq, p);
+  for(rq = &runqs[NCPU-1]; rq >= runqs; rq--)
+    release(&rq->lock);
+  return old;
+}
+
+// Return the id of the current scheduling policy.
+int
+runqpolicy(void)
+{
+  int id;
+
+  for(id = 0; id < NSCHED; id++)
+    if(policies[id] == policy)
+      return id;
+  panic("runqpolicy");
+}
+
+// Is p a real-time process that has used up its budget,
+// with its next period yet to begin? If so it must stay
+// asleep (see rtthrottle). Caller holds p->lock.
+int
+runqthrottled(struct proc *p)
+{
+  return p->rtruntime && p->rtthrottled &&
+    passbefore(ticks, p->rtdl - p->rtdeadline + p->rtperiod);
+}
+
+// p is waking up from sleep. Start a new real-time job if
+// p was throttled and its next period has begun, or if its
+// remaining budget would exceed its share of the time left
+// to its deadline. Caller holds p->lock.
+void
+runqwake(struct proc *p)
+{
+  uint now;
+
+  if(p->rtruntime == 0)
+    return;
+  now = ticks;
+  if(p->rtthrottled){
+    if(runqthrottled(p))
+      return;
+    p->rtthrottled = 0;
+    edf_newjob(p, p->rtdl - p->rtdeadline + p->rtperiod);
+  }
+  if(!passbefore(now, p->rtdl) ||
+     p->rtbudget * p->rtdeadline > (int)(p->rtdl - now) * p->rtruntime)
+    edf_newjob(p, now);
+}
+
+// Charge the running process p for a clock tick.
+// Returns nonzero if p should yield the CPU; if p is
+// real-time and has used up its budget, it sets
+// p->rtthrottled and the caller should call rtthrottle().
+// Caller has interrupts disabled.
+int
+runqtick(struct proc *p)
+{
+  struct runq *rq;
+  struct proc *rt;
+  int cpu, resched;
+
+  cpu = cpuid();
+  rq = &runqs[cpu];
+  p->ticks++;
+  p->runticks++;
+  if(p->rtruntime)
+    return edf_tick(rq, p) || !ALLOWED(p, cpu);
+  resched = policy->tick(rq, p);
+  if(!ALLOWED(p, cpu))
+    return 1;  // affinity changed; move off this CPU
+  // Unlocked peek: a real-time process that may run here is
+  // waiting. Procs are never freed, so rt stays readable.
+  if((rt = rq->edfhead) != 0 && ALLOWED(rt, cpu))
+    return 1;
+  return resched;
+}
+
+// May cpu take p from another CPU's run queue? Not if p may
+// not run on cpu, nor if p ran on its last CPU within the last
+// MIGRATECOST ticks: its cache there is still warm, and that
+// CPU will get to it soon enough. Real-time processes go to
+// whichever CPU can meet their deadline.
+static int
+canmigrate(struct proc *p, int cpu)
+{
+  if(!ALLOWED(p, cpu))
+    return 0;
+  return p->rtruntime || p->lastcpu < 0 || p->lastcpu == cpu ||
+    ticks - p->lastrun >= MIGRATECOST;
+}
+
+// Take the next process off rq for cpu, or return 0 if rq
+// is empty: the earliest-deadline real-time process that may
+// run on cpu, else the policy's choice. If that may not run
+// on cpu, take the oldest process that may, if any. When
+// stealing, processes still cache-hot elsewhere may not run.
+static struct proc*
+rqtake(struct runq *rq, int cpu, int steal)
+{
+  struct proc *p;
+
+#define TAKE(p) (steal ? canmigrate(p, cpu) : ALLOWED(p, cpu))
+  acquire(&rq->lock);
+  p = 0;
+  if(rq->nready > 0){
+    for(p = rq->edfhead; p && !TAKE(p); p = p->edfnext)
+      ;
+    if(p == 0 && (p = policy->pick(rq)) != 0 && !TAKE(p))
+      for(p = rq->head; p && !TAKE(p); p = p->rqnext)
+        ;
+    if(p){
+      rqremove(rq, p);
+      if(p->rtruntime)
+        edf_checkmiss(p);
+    }
+  }
+  release(&rq->lock);
+  return p;
+#undef TAKE
+}
+
+// Choose the next process for this CPU and remove it from
+// its run queue. Falls back to stealing from the busiest
+// other CPU. Returns 0 if nothing is runnable.
+// Called from this CPU's scheduler loop, which never migrates.
+struct proc*
+runqget(void)
+{
+  struct runq *rq, *victim;
+  struct proc *p;
+  int i, cpu;
+
+  pushcli();
+  cpu = cpuid();
+  popcli();
+  rq = &runqs[cpu];
+  if((p = rqtake(rq, cpu, 0)) != 0)
+    return p;
+
+  // Steal. nready is only a hint here; rqtake rechecks it.
+  victim = 0;
+  for(i = 0; i < ncpu; i++){
+    if(&runqs[i] == rq || runqs[i].nready == 0)
+      continue;
+    if(victim == 0 || runqs[i].nready > victim->nready)
+      victim = &runqs[i];
+  }
+  if(victim == 0)
+    return 0;
+  if((p = rqtake(victim, cpu, 1)) != 0)
+    return p;
+
+  // Everything on the busiest queue is pinned or hot elsewhere.
+  for(i = 0; i < ncpu; i++)
+    if(&runqs[i] != rq && &runqs[i] != victim && runqs[i].nready > 0)
+      if((p = rqtake(&runqs[i], cpu, 1)) != 0)
+        return p;
+  return 0;
+}
+
+// Halt this CPU until an interrupt arrives, unless work has
+// been queued for it. runqadd() queues work before looking
+// at halted, and we set halted before looking for work, so
+// one of us always sees the other.
+void
+runqidle(void)
+{
+  struct cpu *c;
+
+  // Zero a page for kalloc_zeroed() rather than halt,
+  // then go back and look for work.
+  if(kzerofill())
+    return;
+
+  cli();
+  c = mycpu();
+  c->halted = 1;
+  __sync_synchronize();
+  if(runqs[c - cpus].nready == 0)
+    stihlt();
+  c->halted = 0;
+  sti();
+}
+
+// Is there nothing to run anywhere? Reads the queue lengths
+// without locks so idle CPUs don't contend on run queue locks.
+int
+runqempty(void)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    if(runqs[i].nready > 0)
+      return 0;
+  return 1;
+}
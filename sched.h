@@ -0,0 +1,8 @@
+// Scheduling policies, for setsched().
+#define SCHED_RR       0   // Round robin
+#define SCHED_FIFO     1   // First come first served
+#define SCHED_LOTTERY  2   // Lottery, by lottery_tickets
+#define SCHED_STRIDE   3   // Stride, by lottery_tickets
+#define SCHED_MLFQ     4   // Multi-level feedback queue
+#define SCHED_CFS      5   // Weighted virtual runtime
+#define NSCHED         6
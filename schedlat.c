@@ -0,0 +1,56 @@
+// Dump scheduling latency histograms; -r resets them afterwards.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+struct cpustat cs[NCPU];
+struct procstat ps[NPROC];
+
+// Print the non-empty buckets of h and the bucket
+// holding the 99th percentile.
+void
+printhist(uint *h)
+{
+  int i, total, seen;
+
+  total = 0;
+  for(i = 0; i < NLATBUCKET; i++)
+    total += h[i];
+  if(total == 0){
+    printf(1, " (none)\n");
+    return;
+  }
+  for(i = 0; i < NLATBUCKET; i++)
+    if(h[i])
+      printf(1, " 2^%d:%d", i, h[i]);
+  seen = 0;
+  for(i = 0; i < NLATBUCKET; i++){
+    seen += h[i];
+    if(seen * 100 >= total * 99)
+      break;
+  }
+  printf(1, "  p99<2^%d\n", i+1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  n = getcpustat(cs, NCPU);
+  for(i = 0; i < n; i++){
+    printf(1, "cpu%d:", cs[i].cpu);
+    printhist(cs[i].lat);
+  }
+  n = getpinfo(ps, NPROC);
+  for(i = 0; i < n; i++){
+    printf(1, "%d %s:", ps[i].pid, ps[i].name);
+    printhist(ps[i].lat);
+  }
+  if(argc > 1 && strcmp(argv[1], "-r") == 0)
+    schedlatreset();
+  exit();
+}
@@ -0,0 +1,235 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of one size. It carves them
+// out of slabs, blocks of 2^order pages from kalloc_order(),
+// and runs the cache's constructor on each object when its
+// slab is made. Callers must free objects in their constructed
+// state (locks released, and so on), so an object can be
+// reused without constructing it again. The free list link is
+// kept after the object so it doesn't disturb that state.
+//
+// Each CPU keeps a mag of up to NSLABMAG free objects per
+// cache; an empty mag refills, and a full one drains, half of
+// NSLABMAG objects at a time under the cache lock. A slab
+// whose objects are all free goes back to the page allocator,
+// unless it is the cache's last one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+#define SLABMAXORDER 4  // Largest slab, 2^4 pages
+#define SLABMINOBJ   8  // Objects per slab to aim for
+
+// Header at the start of each slab.
+struct slab {
+  struct slab *next;     // On the cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  int inuse;             // Objects not on free
+  void *free;            // Free objects
+};
+
+#define SLABHDR   ((sizeof(struct slab) + 7) & ~7)
+#define LINK(c, o) (*(void**)((char*)(o) + (c)->link))
+
+static struct spinlock cachelock;
+static struct kmem_cache *caches;
+
+void
+slabinit(void)
+{
+  initlock(&cachelock, "caches");
+}
+
+// Set up cache c for objects of size bytes, calling ctor
+// (if not 0) on each new object.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size,
+                void (*ctor)(void*))
+{
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->ctor = ctor;
+  c->link = (size + 3) & ~3;
+  c->size = (c->link + sizeof(void*) + 7) & ~7;
+  for(c->order = 0; c->order < SLABMAXORDER; c->order++)
+    if(((PGSIZE << c->order) - SLABHDR) / c->size >= SLABMINOBJ)
+      break;
+  c->perslab = ((PGSIZE << c->order) - SLABHDR) / c->size;
+  if(c->perslab == 0)
+    panic("kmem_cache_init");
+
+  acquire(&cachelock);
+  c->next = caches;
+  caches = c;
+  release(&cachelock);
+}
+
+// Partial list helpers. Caller holds c->lock.
+static void
+slabpush(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Make a new slab and construct its objects.
+// Caller holds c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *base, *o;
+  int i;
+
+  if((base = kalloc_order(c->order)) == 0)
+    return 0;
+  s = (struct slab*)base;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  // Build the free list backward so objects go out in order.
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = base + SLABHDR + i*c->size;
+    if(c->ctor)
+      c->ctor(o);
+    LINK(c, o) = s->free;
+    s->free = o;
+  }
+  slabpush(c, s);
+  c->nslabs++;
+  return s;
+}
+
+// Take an object from a slab. Caller holds c->lock.
+static void*
+slaballoc(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *o;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  o = s->free;
+  s->free = LINK(c, o);
+  s->inuse++;
+  if(s->free == 0)
+    slabunlink(c, s);
+  c->active++;
+  return o;
+}
+
+// Put an object back on its slab. Caller holds c->lock.
+static void
+slabfree(struct kmem_cache *c, void *o)
+{
+  struct slab *s;
+
+  s = (struct slab*)((uint)o & ~((PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("slabfree");
+  if(s->free == 0)
+    slabpush(c, s);
+  LINK(c, o) = s->free;
+  s->free = o;
+  s->inuse--;
+  c->active--;
+  if(s->inuse == 0 && c->nslabs > 1){
+    slabunlink(c, s);
+    c->nslabs--;
+    kfree_order((char*)s, c->order);
+  }
+}
+
+// Allocate a constructed object from c.
+// Returns 0 if memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *o;
+  int id;
+
+  if(c->perslab == 0)
+    panic("kmem_cache_alloc: cache not initialized");
+  pushcli();
+  id = cpuid();
+  if(c->mag[id].n > 0)
+    c->mag[id].hits++;
+  else {
+    c->mag[id].misses++;
+    acquire(&c->lock);
+    while(c->mag[id].n < NSLABMAG/2 && (o = slaballoc(c)) != 0)
+      c->mag[id].obj[c->mag[id].n++] = o;
+    release(&c->lock);
+  }
+  o = 0;
+  if(c->mag[id].n > 0)
+    o = c->mag[id].obj[--c->mag[id].n];
+  popcli();
+  return o;
+}
+
+// Return object o, in its constructed state, to c.
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  int id;
+
+  pushcli();
+  id = cpuid();
+  if(c->mag[id].n == NSLABMAG){
+    acquire(&c->lock);
+    while(c->mag[id].n > NSLABMAG/2)
+      slabfree(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = o;
+  popcli();
+}
+
+// Print each cache's statistics. For debugging;
+// runs with procdump() on ^P.
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+  uint hits, misses;
+  int i, cached;
+
+  cprintf("cache size objs/slab slabs active cached hit%%\n");
+  acquire(&cachelock);
+  for(c = caches; c; c = c->next){
+    hits = misses = 0;
+    cached = 0;
+    for(i = 0; i < ncpu; i++){
+      hits += c->mag[i].hits;
+      misses += c->mag[i].misses;
+      cached += c->mag[i].n;
+    }
+    cprintf("%s %d %d %d %d %d %d\n", c->name, c->size, c->perslab,
+            c->nslabs, c->active - cached, cached,
+            hits + misses ? hits * 100 / (hits + misses) : 0);
+  }
+  release(&cachelock);
+}
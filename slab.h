@@ -0,0 +1,26 @@
+#ifndef SLAB_H
+#define SLAB_H
+#include "spinlock.h"
+
+// Cache of free kernel objects of one size; see slab.c.
+struct kmem_cache {
+  struct spinlock lock;  // Protects everything below but mag
+  char *name;
+  uint link;             // Offset of the free list link in an object
+  uint size;             // Object size, including the link
+  int order;             // Slabs are 2^order pages
+  int perslab;           // Objects per slab
+  void (*ctor)(void*);   // Called on each object when its slab is made
+  struct slab *partial;  // Slabs with free objects
+  int nslabs;
+  int active;            // Objects out of slabs, including in mags
+  struct kmem_cache *next;  // All caches, for slabdump()
+  struct {
+    void *obj[NSLABMAG];
+    int n;
+    uint hits;           // Allocations served from the mag
+    uint misses;         // Allocations that refilled it
+  } mag[NCPU];           // Per-CPU object caches
+};
+
+#endif
@@ -16,29 +16,44 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->holder = 0;
   lk->pid = 0;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+
   acquire(&lk->lk);
   while (lk->locked) {
+    // Lend the holder our priority while we wait. That means
+    // tickets under LOTTERY, STRIDE and CFS, and the MLFQ
+    // level under MLFQ. RR and FIFO have no priorities, so
+    // there is nothing to inherit (see piboost).
+    piboost(lk->holder);
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->holder = p;
+  lk->pid = p->pid;
+  p->nsleeplocks++;
   release(&lk->lk);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->holder = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeup_one(lk);
   release(&lk->lk);
+  if(--p->nsleeplocks == 0)
+    piunboost();
 }
 
 int
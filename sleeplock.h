@@ -9,6 +9,7 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *holder; // Process holding lock, for priority inheritance
   
   // For debugging:
   char *name;        // Name of lock.
@@ -107,6 +107,20 @@ extern int sys_uptime(void);
 extern int sys_uniq(void);
 extern int sys_ticks_running(void);
 extern int sys_set_lottery_tickets(void);
+extern int sys_setsched(void);
+extern int sys_wait2(void);
+extern int sys_getpinfo(void);
+extern int sys_setaffinity(void);
+extern int sys_getaffinity(void);
+extern int sys_getcpustat(void);
+extern int sys_schedlatreset(void);
+extern int sys_transfer_tickets(void);
+extern int sys_setrt(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_clock_gettime(void);
+extern int sys_freemem(void);
 extern int sys_get_lottery_tickets(void);
 extern int sys_lseek(void);
 extern int sys_symlink(void); // Add declaration for the symlink system call
@@ -140,6 +154,20 @@ static int (*syscalls[])(void) = {
 [SYS_get_lottery_tickets] sys_get_lottery_tickets,
 [SYS_symlink] sys_symlink, // Add entry for the symlink system call
 [SYS_lseek] sys_lseek,
+[SYS_setsched] sys_setsched,
+[SYS_wait2]   sys_wait2,
+[SYS_getpinfo] sys_getpinfo,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
+[SYS_getcpustat] sys_getcpustat,
+[SYS_schedlatreset] sys_schedlatreset,
+[SYS_transfer_tickets] sys_transfer_tickets,
+[SYS_setrt]   sys_setrt,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_freemem] sys_freemem,
 
 };
 
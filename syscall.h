@@ -26,3 +26,17 @@
 #define SYS_set_lottery_tickets 25
 #define SYS_symlink  26
 #define SYS_lseek 27
+#define SYS_setsched 28
+#define SYS_wait2 29
+#define SYS_getpinfo 30
+#define SYS_setaffinity 31
+#define SYS_getaffinity 32
+#define SYS_getcpustat 33
+#define SYS_schedlatreset 34
+#define SYS_transfer_tickets 35
+#define SYS_setrt  36
+#define SYS_clone  37
+#define SYS_join   38
+#define SYS_futex  39
+#define SYS_clock_gettime 40
+#define SYS_freemem 41
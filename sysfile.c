@@ -78,15 +78,22 @@ int resolve_symlink(struct inode **ip, const char *path, int flags) {
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// Takes a reference to the file, so a sibling thread's close() can't
+// free it; the caller must fileclose() it when done.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct files *fs = myproc()->files;
 
-  if(argint(n, &fd) < 0)
+  if(argint(n, &fd) < 0 || fd < 0 || fd >= NOFILE)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    filedup(f);
+  release(&fs->lock);
+  if(f == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -101,14 +108,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct files *fs = myproc()->files;
 
+  acquire(&fs->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
       return fd;
     }
   }
+  release(&fs->lock);
   return -1;
 }
 
@@ -120,9 +130,10 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -130,24 +141,28 @@ int
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
@@ -155,10 +170,16 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct files *fs = myproc()->files;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    fs->ofile[fd] = 0;
+  release(&fs->lock);
+  if(f == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -168,10 +189,13 @@ sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argptr(1, (void*)&st, sizeof(*st)) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 
@@ -478,8 +502,8 @@ int
 sys_chdir(void)
 {
   char *path;
-  struct inode *ip;
-  struct proc *curproc = myproc();
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
   
   begin_op();
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
@@ -493,9 +517,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(curproc->cwd);
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  iput(old);
   end_op();
-  curproc->cwd = ip;
   return 0;
 }
 
@@ -538,8 +565,11 @@ sys_pipe(void)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+    if(fd0 >= 0){
+      acquire(&myproc()->files->lock);
+      myproc()->files->ofile[fd0] = 0;
+      release(&myproc()->files->lock);
+    }
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -554,13 +584,10 @@ sys_find(void){
 return 0;
 }
 int sys_lseek(void) {
-    int fd, offset;
-
-    if(argint(0, &fd) < 0 || argint(1, &offset) < 0)
-        return -1;
-
+    int offset;
     struct file *f;
-    if((f = myproc()->ofile[fd]) == 0)
+
+    if(argint(1, &offset) < 0 || argfd(0, 0, &f) < 0)
         return -1;
 
     f->off = offset;
@@ -568,5 +595,7 @@ int sys_lseek(void) {
     if(f->off < 0)
         f->off = 0;
 
-    return f->off;
+    offset = f->off;
+    fileclose(f);
+    return offset;
 }
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pstat.h"
+#include "futex.h"
 #include "defs.h"
 #define sleep sleep_ignore_conflict
 #define syscall syscall_ignore_conflict
@@ -38,6 +40,21 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_wait2(void)
+{
+  int *retime, *rutime, *stime;
+
+  if(argptr(0, (char**)&retime, sizeof(int)) < 0 ||
+     argptr(1, (char**)&rutime, sizeof(int)) < 0 ||
+     argptr(2, (char**)&stime, sizeof(int)) < 0)
+    return -1;
+  // Touch the results now: wait2 fills them in
+  // holding process locks, where a lazy page fault won't do.
+  *retime = *rutime = *stime = 0;
+  return wait2(retime, rutime, stime);
+}
+
 int
 sys_kill(void)
 {
@@ -62,12 +79,11 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
   /*
   if(growproc(n) < 0)
     return -1;
   */
- myproc()->sz += n;
+  addr = lazygrow(n);
   return addr;
 }
 
@@ -100,17 +116,158 @@ int sys_ticks_running(void) {
 }
 
 int sys_set_lottery_tickets(void) {
-  int tickets;
-  if(argint(0, &tickets) < 0) return -1;
-  myproc()->lottery_tickets = tickets;
+  int tickets, pid;
+  if(argint(0, &tickets) < 0 || argint(1, &pid) < 0) return -1;
+  if(tickets < 1 || tickets > MAX_TICKETS) return -1;
+  return set_lottery_tickets(tickets, pid);
+}
+int
+sys_getpinfo(void)
+{
+  struct procstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argptr(0, (char**)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  // Fault the buffer in before getpinfo takes process locks.
+  memset(ps, 0, n*sizeof(*ps));
+  return getpinfo(ps, n);
+}
+
+int
+sys_getcpustat(void)
+{
+  struct cpustat *cs;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU)
+    n = NCPU;
+  if(argptr(0, (char**)&cs, n*sizeof(*cs)) < 0)
+    return -1;
+  return getcpustat(cs, n);
+}
+
+int
+sys_schedlatreset(void)
+{
+  schedlatreset();
   return 0;
 }
+
+int
+sys_setsched(void)
+{
+  int policy;
+
+  if(argint(0, &policy) < 0)
+    return -1;
+  return setsched(policy);
+}
+
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  if(setaffinity(pid, mask) < 0)
+    return -1;
+  // Leave this CPU now if it is no longer in our own mask.
+  if(pid == myproc()->pid)
+    yield();
+  return 0;
+}
+
+int
+sys_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getaffinity(pid);
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argptr(2, &stack, PGSIZE) < 0)
+    return -1;
+  if((uint)fn >= myproc()->sz)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, stack);
+}
+
+int
+sys_join(void)
+{
+  uint *stack;
+  uint s;
+  int pid;
+
+  if(argptr(0, (char**)&stack, sizeof(*stack)) < 0)
+    return -1;
+  if((pid = join(&s)) >= 0)
+    *stack = s;
+  return pid;
+}
+
+int
+sys_futex(void)
+{
+  int *addr;
+  int op, val;
+
+  if(argptr(0, (char**)&addr, sizeof(*addr)) < 0 ||
+     argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if((uint)addr % sizeof(*addr))
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
+
+int
+sys_setrt(void)
+{
+  int runtime, period, deadline;
+
+  if(argint(0, &runtime) < 0 || argint(1, &period) < 0 ||
+     argint(2, &deadline) < 0)
+    return -1;
+  return setrt(runtime, period, deadline);
+}
+
+int
+sys_transfer_tickets(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return transfer_tickets(pid, n);
+}
+
 int sys_get_lottery_tickets(void) {
   int pid;
   if (argint(0, &pid) < 0) return -1;
-  struct proc *p = get_proc(pid);
-  if (p == 0 || p->state == UNUSED || p->state == ZOMBIE) return -1;
-  return p->lottery_tickets;
+  return get_lottery_tickets(pid);
 }
 
 // return how many clock tick interrupts have occurred
@@ -126,6 +283,18 @@ sys_uptime(void)
   return xticks;
 }
 
+// Time since boot to the nanosecond, from the TSC.
+int
+sys_clock_gettime(void)
+{
+  struct timespec *ts;
+
+  if(argptr(0, (char**)&ts, sizeof(*ts)) < 0)
+    return -1;
+  nanouptime(ts);
+  return 0;
+}
+
 int
 sys_uniq(void)
 {
@@ -145,3 +314,10 @@ sys_uniq(void)
 
   return 0;
 }
+
+// Return the number of free physical pages.
+int
+sys_freemem(void)
+{
+  return kfreecount();
+}
@@ -24,10 +24,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -70,6 +69,85 @@ tvinit(void)
   initlock(&tickslock, "time");
 }
 
+// Map the page the current process faulted on: make a copy
+// of a copy-on-write page it wrote, or allocate a page sbrk()
+// reserved but has not mapped. Returns 0 if the fault is not
+// one of those, such as an access to the stack guard page or
+// past the end of the process's memory.
+static int
+pgfault(struct trapframe *tf)
+{
+  struct proc *p = myproc();
+  uint addr, va;
+  char *mem;
+  pte_t *pte;
+  int i, j, cow, ok;
+
+  j = 1;
+  #ifdef LOCALITY
+    j = 3;
+  #endif
+  addr = rcr2();
+  if(addr >= p->sz)
+    return 0;
+
+  // Threads share page tables and may fault on the same
+  // page at once, so map each page only if nobody has yet.
+  acquire(&p->vm->lock);
+
+  // A write to a page shared copy-on-write since fork.
+  if(tf->err & FEC_WR){
+    cow = cowfault(p->pgdir, addr);
+    if(cow < 0){
+      release(&p->vm->lock);
+      cprintf("Page allocation failed\n");
+      exit();
+    }
+    if(cow > 0){
+      release(&p->vm->lock);
+      return 1;
+    }
+  }
+  for(i = 0; i < j; i++){
+    va = PGROUNDDOWN(addr) + i*PGSIZE;
+    if(va >= p->sz)
+      break;
+    pte = walkpgdir(p->pgdir, (void*)va, 0);
+    if(pte && (*pte & PTE_P)){
+      if(i > 0)
+        continue;
+      // Fine if another thread mapped it first; not if the
+      // page forbids the access.
+      ok = (*pte & PTE_U) && (!(tf->err & FEC_WR) || (*pte & PTE_W));
+      release(&p->vm->lock);
+      return ok;
+    }
+    if(i == 0){
+      #ifdef LOCALITY
+        cprintf("LOCALITY\n");
+      #else
+        cprintf("LAZY\n");
+      #endif
+    }
+    mem = kalloc_zeroed();
+    cprintf("Allocating New Page (%d)\n", i + 1);
+    if (mem == 0) {
+      release(&p->vm->lock);
+      cprintf("Page allocation failed\n");
+      exit();
+    }
+
+    if(mappages(p->pgdir, (void*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0) {
+      release(&p->vm->lock);
+      cprintf("Failed to map page\n");
+      kfree(mem);
+      exit();
+    }
+  }
+  release(&p->vm->lock);
+  return 1;
+}
+
 void
 idtinit(void)
 {
@@ -80,9 +158,6 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
-  uint addr;
-  char *mem;
-  int j = 1;
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -101,6 +176,14 @@ trap(struct trapframe *tf)
       wakeup(&ticks);
       release(&tickslock);
     }
+    if(myproc())
+      mycpu()->busyticks++;
+    else
+      mycpu()->idleticks++;
+    lapiceoi();
+    break;
+  case T_WAKEUP:
+    // Only here to bring a halted scheduler back to life.
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -125,31 +208,9 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
   case T_PGFLT:
-    j = 1;
-    #ifdef LOCALITY
-      cprintf("LOCALITY\n");
-      j = 3;
-    #else
-      cprintf("LAZY\n");
-    #endif
-    addr = rcr2();
-
-    for (int i = 0; i < j; i++) {
-      mem = kalloc();
-      cprintf("Allocating New Page (%d)\n", i + 1);
-      if (mem == 0) {
-        cprintf("Page allocation failed\n");
-        exit();
-      }
-      memset(mem, 0, PGSIZE);
-
-      if(mappages(myproc()->pgdir, (void*)(PGROUNDDOWN(addr) + i*PGSIZE), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0) {
-        cprintf("Failed to map page\n");
-        kfree(mem);
-        exit();
-      }
-    }
-    break;
+    if(myproc() && pgfault(tf))
+      break;
+    // Not a page we can map; treat as a bad trap.
 
   //PAGEBREAK: 13
   default:
@@ -176,8 +237,12 @@ trap(struct trapframe *tf)
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+     tf->trapno == T_IRQ0+IRQ_TIMER && runqtick(myproc())){
+    if(myproc()->rtthrottled)
+      rtthrottle();
+    else
+      yield();
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -2,6 +2,9 @@
 
 struct stat;
 struct rtcdate;
+struct timespec;
+struct procstat;
+struct cpustat;
 
 // system calls
 int fork(void);
@@ -25,11 +28,24 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int clock_gettime(struct timespec*);
+int freemem(void);
 int uniq(int);
 int ticks_running(int);
-void set_lottery_tickets(int,int);
+int set_lottery_tickets(int,int);
 int get_lottery_tickets(int);
-//int wait2(int*, int*, int*);
+int setsched(int);
+int transfer_tickets(int, int);
+int setrt(int, int, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex(int*, int, int);
+int wait2(int*, int*, int*);
+int getpinfo(struct procstat*, int);
+int setaffinity(int, uint);
+int getaffinity(int);
+int getcpustat(struct cpustat*, int);
+int schedlatreset(void);
 int symlink(const char *target, const char *path);
 
 
@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "futex.h"
 
 char buf[8192];
 char name[3];
@@ -400,6 +401,156 @@ preempt(void)
   printf(1, "preempt ok\n");
 }
 
+// threads share memory; a futex lock keeps their
+// increments of a shared counter from being lost.
+int tlockword, tcount;
+
+void
+tlock(int *l)
+{
+  while(__sync_lock_test_and_set(l, 1))
+    futex(l, FUTEX_WAIT, 1);
+}
+
+void
+tunlock(int *l)
+{
+  __sync_lock_release(l);
+  futex(l, FUTEX_WAKE, 1);
+}
+
+void
+clonefn(void *arg)
+{
+  int i;
+
+  for(i = 0; i < (int)arg; i++){
+    tlock(&tlockword);
+    tcount++;
+    tunlock(&tlockword);
+  }
+  exit();
+}
+
+void
+clonetest(void)
+{
+  void *stack;
+  int i;
+
+  printf(stdout, "clone test\n");
+  for(i = 0; i < 4; i++){
+    if(clone(clonefn, (void*)1000, malloc(4096)) < 0){
+      printf(stdout, "clone failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(join(&stack) < 0){
+      printf(stdout, "join failed\n");
+      exit();
+    }
+    free(stack);
+  }
+  if(join(&stack) >= 0 || wait() >= 0){
+    printf(stdout, "join: no threads left but join succeeded\n");
+    exit();
+  }
+  if(tcount != 4000){
+    printf(stdout, "clone test: lost updates, count %d\n", tcount);
+    exit();
+  }
+  printf(stdout, "clone test ok\n");
+}
+
+// fork shares pages copy-on-write; check that parent and
+// child each see only their own writes, whichever side
+// writes a page first, and that every page comes back.
+char cowbuf[2*4096];
+
+void
+cowtest(void)
+{
+  int p2c[2], c2p[2], pid, i, ok, free0, free1;
+  char c;
+
+  printf(stdout, "cow test\n");
+  cowbuf[0] = 'p';
+  cowbuf[4096] = 'p';
+  if(pipe(p2c) < 0 || pipe(c2p) < 0){
+    printf(stdout, "cow test: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Child writes page 0 first, and page 1 after the parent.
+    ok = cowbuf[0] == 'p';
+    cowbuf[0] = 'c';
+    write(c2p[1], "x", 1);
+    if(read(p2c[0], &c, 1) != 1)
+      ok = 0;
+    if(cowbuf[0] != 'c' || cowbuf[4096] != 'p')
+      ok = 0;
+    cowbuf[4096] = 'c';
+    if(cowbuf[4096] != 'c')
+      ok = 0;
+    write(c2p[1], ok ? "y" : "n", 1);
+    exit();
+  }
+  if(read(c2p[0], &c, 1) != 1 || cowbuf[0] != 'p'){
+    printf(stdout, "cow test: parent saw child's write\n");
+    exit();
+  }
+  cowbuf[0] = 'P';
+  cowbuf[4096] = 'P';
+  write(p2c[1], "x", 1);
+  if(read(c2p[0], &c, 1) != 1 || c != 'y'){
+    printf(stdout, "cow test: child saw parent's write\n");
+    exit();
+  }
+  if(cowbuf[0] != 'P' || cowbuf[4096] != 'P'){
+    printf(stdout, "cow test: parent lost its writes\n");
+    exit();
+  }
+  wait();
+  close(p2c[0]);
+  close(p2c[1]);
+  close(c2p[0]);
+  close(c2p[1]);
+
+  // Shared pages must be freed when the last sharer lets go.
+  // The first round warms up the kernel's object caches.
+  free0 = 0;
+  for(i = 0; i < 11; i++){
+    if(i == 1)
+      free0 = freemem();
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "cow test: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      cowbuf[i & 1 ? 0 : 4096] = 'c';
+      exit();
+    }
+    if(i & 2)
+      cowbuf[0] = 'P';  // parent copies too, sometimes first
+    wait();
+  }
+  free1 = freemem();
+  // Leaking one fork's worth of shared pages would show as
+  // far more than a few pages.
+  if(free1 < free0 - 4){
+    printf(stdout, "cow test: %d pages lost\n", free0 - free1);
+    exit();
+  }
+  printf(stdout, "cow test ok\n");
+}
+
 // try to find any races between exit and wait
 void
 exitwait(void)
@@ -1783,6 +1934,8 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  clonetest();
+  cowtest();
 
   rmdot();
   fourteen();
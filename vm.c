@@ -42,10 +42,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -121,9 +120,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -186,8 +184,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +228,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -311,9 +307,13 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. With cow set, parent and child share
+// each page read-only until one of them writes it (see
+// cowfault); pgdir must be the current page table and no
+// other CPU may be using it. Otherwise each page is copied.
+// Pages a lazy allocator never mapped are left unmapped.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, int cow)
 {
   pde_t *d;
   pte_t *pte;
@@ -323,11 +323,17 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
     pa = PTE_ADDR(*pte);
+    if(cow){
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+        goto bad;
+      kref(P2V(pa));
+      continue;
+    }
     flags = PTE_FLAGS(*pte);
     if((mem = kalloc()) == 0)
       goto bad;
@@ -337,13 +343,62 @@ copyuvm(pde_t *pgdir, uint sz)
       goto bad;
     }
   }
+  if(cow)
+    lcr3(V2P(pgdir));  // our writable TLB entries are stale
   return d;
 
 bad:
+  if(cow)
+    lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write to the user page at va in the current
+// page table pgdir. Returns 0 if the page is not
+// copy-on-write, 1 once the page is writable, or -1 if
+// there is no memory for a copy. Only single-threaded
+// address spaces have copy-on-write pages (see cowbreak),
+// so flushing this CPU's TLB is enough.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  pte = walkpgdir(pgdir, (void*)PGROUNDDOWN(va), 0);
+  if(pte == 0 || !(*pte & PTE_P) || !(*pte & PTE_COW))
+    return 0;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcnt(old) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(old);
+  }
+  // The last sharer can just take the page.
+  *pte = (*pte | PTE_W) & ~PTE_COW;
+  lcr3(V2P(pgdir));
+  return 1;
+}
+
+// Make every copy-on-write page below sz in the current page
+// table pgdir private and writable, as if each were written.
+// Called before a second thread starts using pgdir: a page
+// copied on one CPU could stay in another CPU's TLB, which
+// nothing would flush. Returns -1 if out of memory.
+int
+cowbreak(pde_t *pgdir, uint sz)
+{
+  uint va;
+
+  for(va = 0; va < sz; va += PGSIZE)
+    if(cowfault(pgdir, va) < 0)
+      return -1;
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
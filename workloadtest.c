@@ -1,11 +1,13 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "sched.h"
 
+char *policyNames[NSCHED] = {"RR", "FIFO", "LOTTERY", "STRIDE", "MLFQ", "CFS"};
 int scheduledUptime[4], scheduledTicks[4];
 
 
-void runCommand(char *command, char **argv, int index) {
+void runCommand(char *command, char **argv, int index, int policy) {
     int pid = fork();
     if (pid < 0) {
         printf(1, "Fork failed\n");
@@ -18,8 +20,12 @@ void runCommand(char *command, char **argv, int index) {
             printf(1, "exec %s failed\n", command);
         }
         else if (index < 4) {
+            int retime, rutime, stime;
+            if (wait2(&retime, &rutime, &stime) < 0)
+                retime = rutime = stime = 0;
             while (wait() > 0) sleep(1);
-            printf(1, "\n\n\n%s Turnaround Uptime: %d\n\n\n", command, uptime() - scheduledUptime[index]);
+            printf(1, "\n\n\n[%s] %s Turnaround Uptime: %d\n", policyNames[policy], command, uptime() - scheduledUptime[index]);
+            printf(1, "[%s] %s Waiting: %d Running: %d Sleeping: %d\n\n\n", policyNames[policy], command, retime, rutime, stime);
             exit();
         }
         else {
@@ -30,31 +36,45 @@ void runCommand(char *command, char **argv, int index) {
 
 }
 
-int main(void) {
+void runWorkload(int policy) {
+    int start = uptime();
 
     char *stressfs_argv[] = {"stressfs", 0};
     scheduledUptime[0] = uptime();
     scheduledTicks[0] = ticks_running(getpid());
-    runCommand("stressfs", stressfs_argv, 0);
+    runCommand("stressfs", stressfs_argv, 0, policy);
 
     char *find_argv[] = {"find", "/", 0};
     scheduledUptime[1] = uptime();
     scheduledTicks[1] = ticks_running(getpid());
-    runCommand("find", find_argv, 1);
+    runCommand("find", find_argv, 1, policy);
 
     char *cat_argv[] = {"cat", "README", 0};
     scheduledUptime[2] = uptime();
     scheduledTicks[2] = ticks_running(getpid());
-    runCommand("cat", cat_argv, 2); // Assuming the 'uniq' part is handled in shell
+    runCommand("cat", cat_argv, 2, policy); // Assuming the 'uniq' part is handled in shell
 
     char *sleep_argv[] = {"sleep", "100", 0};
     scheduledUptime[3] = uptime();
     scheduledTicks[3] = ticks_running(getpid());
-    runCommand("sleep", sleep_argv, 4);
-    runCommand("sleep", sleep_argv, 4);
-    runCommand("sleep", sleep_argv, 3);
-
+    runCommand("sleep", sleep_argv, 4, policy);
+    runCommand("sleep", sleep_argv, 4, policy);
+    runCommand("sleep", sleep_argv, 3, policy);
 
     while (wait() > 0) sleep(1);
+    printf(1, "[%s] Workload Turnaround Uptime: %d\n", policyNames[policy], uptime() - start);
+}
+
+int main(void) {
+    int policy, old;
+
+    // Sweep every scheduling policy in one boot, then put
+    // back the one we started with.
+    old = setsched(SCHED_RR);
+    for (policy = 0; policy < NSCHED; policy++) {
+        setsched(policy);
+        runWorkload(policy);
+    }
+    setsched(old);
     exit();
-}
\ No newline at end of file
+}